@@ -0,0 +1,729 @@
+/*
+ *  This file is part of ScoreBoard project.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * ScoreBoard HOST build: the simulated board behind the hal* functions.
+ *
+ * Every peripheral which raises an interrupt or wakes the CPU up is a source
+ * with the simulated time its next event is due. The time moves forward only in
+ * halSleep (to the first event due) and in the blocking waits (hostSpend): the
+ * events due meanwhile are served in time order, each one raising its interrupt
+ * through hostInterrupt when the interrupts are enabled. The firmware code
+ * itself takes no time, besides the costs of the blocking operations.
+ */
+
+#include "host.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+// Sources of the events
+enum HostSource {
+  SRC_TIMER0,           // Core millis timer: wakes the CPU up, triggers the ADC
+  SRC_TIMER1,
+  SRC_TIMER2,
+  SRC_ADC,
+  SRC_SPI,
+  SRC_EEPROM,
+  SRC_SERIAL_TX,        // Core TX interrupt (wakes the CPU up only), transmit complete
+  SRC_COMPARATOR,
+  SRC_SOURCES
+};
+
+#define NEVER                   UINT64_MAX
+
+static uint64_t due[SRC_SOURCES];
+
+uint8_t SREG = 0;
+uint64_t hostTime = 0;
+boolean hostRealtime = false;
+
+uint32_t hostInterrupts = 0;
+uint32_t hostWakeups = 0;
+uint64_t hostSleepTime = 0;
+
+uint8_t hostPin[HOST_PINS];
+void (*hostPinHook)(uint8_t pin, uint8_t level) = NULL;
+
+uint16_t hostAdcLevel[8];
+uint16_t (*hostAdcSource)(uint8_t channel) = NULL;
+
+uint8_t hostChain[HOST_PINS][HOST_CHAIN_DIGITS];
+uint8_t hostShown[HOST_PINS][HOST_CHAIN_DIGITS];
+boolean hostDisplayOn = false;
+uint8_t hostPwmDuty = 0;
+uint32_t hostFrames = 0;
+uint64_t hostFirstFrameTime = 0;
+void (*hostFrameHook)() = NULL;
+
+uint8_t *hostEeprom = NULL;
+uint32_t hostEepromWrites = 0;
+
+char hostSerialOutput[HOST_SERIAL_OUTPUT];
+uint16_t hostSerialOutputLength = 0;
+FILE *hostSerialEcho = NULL;
+
+// Timer1 compare period (us)
+static uint32_t timer1Period;
+
+// ADC: started by the Timer0 overflow once enabled, channel selected, and
+// result of the conversion running
+static boolean adcEnabled;
+static uint8_t adcMux;
+static uint16_t adcResult;
+
+// SPI byte being shifted out
+static uint8_t spiData;
+
+// Byte being shifted into the display chains of the parallel bus, bit count
+static uint8_t busByte[HOST_PINS];
+static uint8_t busBits[HOST_PINS];
+
+// EEPROM write in progress, completed at due[SRC_EEPROM]
+static boolean eepromBusy;
+static boolean eepromInterrupt;
+static uint16_t eepromAddress;
+static uint8_t eepromData;
+static uint64_t eepromDone;
+
+// Serial: bytes in the TX buffer (the first one being shifted out until
+// serialTxDone), transmit complete flag (set when the last one is out, cleared
+// by a write) and its interrupt, RX bytes queued, pty master side
+static uint8_t serialTxQueued;
+static uint64_t serialTxDone;
+static boolean serialTxComplete;
+static boolean serialTxInterrupt;
+static uint8_t serialRx[256];
+static uint8_t serialRxHead;
+static uint8_t serialRxTail;
+static int ptyMaster = -1;
+static int ptySlave = -1;
+static char ptyName[64];
+
+static boolean comparatorOn;
+static boolean powerGood;
+
+// End of the hold-up time: EEPROM writes not complete by then are lost
+static uint64_t powerOffTime;
+
+// Wall clock (us) at simulated time 0, for the realtime pace
+static uint64_t realStart;
+static boolean realStarted = false;
+
+uint64_t hostWallClock() {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static void eepromAllocate() {
+  if (hostEeprom == NULL) {
+    void *memory = mmap(NULL, HOST_EEPROM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+    if (memory == MAP_FAILED) {
+      perror("mmap");
+      exit(2);
+    }
+    hostEeprom = (uint8_t *) memory;
+    memset(hostEeprom, 0xFF, HOST_EEPROM_SIZE);
+  }
+}
+
+// The byte being written is in the EEPROM at the end of the write only, with
+// the supply still up
+static void eepromUpdate() {
+  if (eepromBusy && hostTime >= eepromDone) {
+    if (eepromDone <= powerOffTime) {
+      hostEeprom[eepromAddress] = eepromData;
+    }
+    eepromBusy = false;
+  }
+}
+
+// The EEPROM ready interrupt is a level: due as long as enabled and ready
+static void eepromSchedule() {
+  due[SRC_EEPROM] = eepromBusy ? eepromDone : (eepromInterrupt ? hostTime : NEVER);
+}
+
+// The transmit complete interrupt is a level: due as long as enabled and complete
+static void serialTxUpdate() {
+  while (serialTxQueued > 0 && hostTime >= serialTxDone) {
+    serialTxComplete = --serialTxQueued == 0;
+    serialTxDone += HOST_SERIAL_BYTE_US;
+  }
+  if (serialTxQueued > 0) {
+    due[SRC_SERIAL_TX] = serialTxDone;
+  } else {
+    due[SRC_SERIAL_TX] = serialTxComplete && serialTxInterrupt ? hostTime : NEVER;
+  }
+}
+
+// Received bytes: the queue, refilled from the pty
+static uint8_t serialRxCount() {
+  uint8_t c;
+
+  while (ptyMaster >= 0 && (uint8_t) (serialRxHead - serialRxTail) < 255 && read(ptyMaster, &c, 1) == 1) {
+    serialRx[serialRxHead++] = c;
+  }
+  return serialRxHead - serialRxTail;
+}
+
+static void chainShift(uint8_t pin, uint8_t value) {
+  memmove(&hostChain[pin][1], &hostChain[pin][0], HOST_CHAIN_DIGITS - 1);
+  hostChain[pin][0] = value;
+}
+
+static void raise(uint8_t vector, uint16_t value) {
+  uint8_t sreg = SREG;
+
+  SREG &= ~0x80;
+  hostInterrupts++;
+  hostInterrupt(vector, value);
+  SREG = sreg;
+}
+
+static uint8_t nextSource() {
+  uint8_t next = 0;
+
+  for (uint8_t s = 1; s < SRC_SOURCES; s++) {
+    if (due[s] < due[next]) {
+      next = s;
+    }
+  }
+  return next;
+}
+
+// Event of "source", due now
+static void serve(uint8_t source) {
+  switch (source) {
+    case SRC_TIMER0:
+      due[source] += HOST_TIMER_CYCLE_US;
+      if (adcEnabled) {
+        adcResult = hostAdcSource != NULL ? hostAdcSource(adcMux) : hostAdcLevel[adcMux];
+        due[SRC_ADC] = hostTime + HOST_ADC_US;
+      }
+      break;
+
+    case SRC_TIMER1:
+      due[source] += timer1Period;
+      raise(HOST_TIMER1_COMPA, 0);
+      break;
+
+    case SRC_TIMER2:
+      due[source] += HOST_TIMER_CYCLE_US;
+      raise(HOST_TIMER2_OVF, 0);
+      break;
+
+    case SRC_ADC:
+      // The next conversion waits for the next Timer0 overflow
+      due[source] = NEVER;
+      raise(HOST_ADC, adcResult);
+      break;
+
+    case SRC_SPI:
+      due[source] = NEVER;
+      chainShift(HOST_SPI_MOSI, spiData);
+      raise(HOST_SPI_STC, 0);
+      break;
+
+    case SRC_EEPROM:
+      eepromUpdate();
+      if (!eepromBusy && eepromInterrupt) {
+        raise(HOST_EE_READY, 0);
+      }
+      eepromSchedule();
+      break;
+
+    case SRC_SERIAL_TX:
+      serialTxUpdate();
+      if (serialTxQueued == 0 && serialTxComplete && serialTxInterrupt) {
+        serialTxComplete = false;
+        raise(HOST_USART_TX, 0);
+        serialTxUpdate();
+      }
+      break;
+
+    case SRC_COMPARATOR:
+      due[source] = NEVER;
+      powerGood = false;
+      raise(HOST_ANALOG_COMP, 0);
+      break;
+  }
+}
+
+// Serve the events due up to "limit", while the interrupts are enabled
+static void serveDue(uint64_t limit) {
+  while (SREG & 0x80) {
+    uint8_t source = nextSource();
+
+    if (due[source] > limit) {
+      break;
+    }
+    if (due[source] > hostTime) {
+      hostTime = due[source];
+    }
+    serve(source);
+  }
+}
+
+void hostPowerOn() {
+  eepromAllocate();
+
+  SREG = 0;
+  hostTime = 0;
+  for (uint8_t s = 0; s < SRC_SOURCES; s++) {
+    due[s] = NEVER;
+  }
+  // The core starts Timer0 before setup
+  due[SRC_TIMER0] = HOST_TIMER_CYCLE_US;
+
+  memset(hostPin, 0, sizeof(hostPin));
+  memset(hostChain, 0, sizeof(hostChain));
+  memset(hostShown, 0, sizeof(hostShown));
+  memset(busBits, 0, sizeof(busBits));
+  hostDisplayOn = false;
+  hostPwmDuty = 0;
+  hostFrames = 0;
+  hostFirstFrameTime = 0;
+  hostEepromWrites = 0;
+  hostInterrupts = 0;
+  hostWakeups = 0;
+  hostSleepTime = 0;
+  hostSerialOutputLength = 0;
+
+  adcEnabled = false;
+  eepromBusy = false;
+  eepromInterrupt = false;
+  serialTxQueued = 0;
+  serialTxComplete = false;
+  serialTxInterrupt = false;
+  serialRxHead = 0;
+  serialRxTail = 0;
+  comparatorOn = false;
+  powerGood = true;
+  powerOffTime = NEVER;
+  realStarted = false;
+}
+
+void hostSpend(uint32_t us) {
+  uint64_t end = hostTime + us;
+
+  serveDue(end);
+  hostTime = end;
+}
+
+void cli() {
+  SREG &= ~0x80;
+}
+
+void sei() {
+  SREG |= 0x80;
+  serveDue(hostTime);
+}
+
+uint16_t _crc_ccitt_update(uint16_t crc, uint8_t data) {
+  data ^= crc & 0xFF;
+  data ^= data << 4;
+  return ((((uint16_t) data << 8) | (crc >> 8)) ^ (uint8_t) (data >> 4) ^ ((uint16_t) data << 3));
+}
+
+// ###################### Timers and ADC ######################
+
+void halTimer1Init(uint16_t top) {
+  timer1Period = ((uint32_t) top + 1) * 16;
+  due[SRC_TIMER1] = NEVER;
+}
+
+void halTimer1Run(boolean run) {
+  due[SRC_TIMER1] = run ? hostTime + timer1Period : NEVER;
+}
+
+void halTimer1Restart() {
+  if (due[SRC_TIMER1] != NEVER) {
+    due[SRC_TIMER1] = hostTime + timer1Period;
+  }
+}
+
+void halAdcInit(uint8_t channel, uint8_t digitalInputs) {
+  adcEnabled = true;
+  adcMux = channel;
+}
+
+void halAdcSelect(uint8_t channel) {
+  adcMux = channel;
+}
+
+// ######################## Display ########################
+
+void halSpiInit() {
+}
+
+void halSpiWrite(byte value) {
+  spiData = value;
+  due[SRC_SPI] = hostTime + HOST_SPI_BYTE_US;
+}
+
+void halBusShift(uint8_t dataMask, uint8_t clockMask, uint8_t bits) {
+  for (uint8_t pin = 0; pin < 8; pin++) {
+    if (dataMask & _BV(pin)) {
+      busByte[pin] = busByte[pin] << 1 | ((bits & _BV(pin)) != 0);
+      if (++busBits[pin] == 8) {
+        chainShift(pin, busByte[pin]);
+        busBits[pin] = 0;
+      }
+    }
+  }
+  hostSpend(1);
+}
+
+void halShiftOut(uint8_t dataPin, uint8_t clockPin, uint8_t value) {
+  chainShift(dataPin, value);
+  hostSpend(HOST_SHIFT_OUT_US);
+}
+
+void halPwmInit(boolean inverted) {
+  hostPwmDuty = 0;
+}
+
+void halPwmDuty(uint8_t duty) {
+  hostPwmDuty = duty;
+}
+
+// The shift register outputs show what has been shifted in when enabled
+void halPwmOutput(boolean connect) {
+  if (connect && !hostDisplayOn) {
+    memcpy(hostShown, hostChain, sizeof(hostShown));
+    if (hostFrames++ == 0) {
+      hostFirstFrameTime = hostTime;
+    }
+    hostDisplayOn = true;
+    if (hostFrameHook != NULL) {
+      hostFrameHook();
+    }
+  }
+  hostDisplayOn = connect;
+}
+
+void halPwmInterrupt(boolean enable) {
+  due[SRC_TIMER2] = enable ? (hostTime / HOST_TIMER_CYCLE_US + 1) * HOST_TIMER_CYCLE_US : NEVER;
+}
+
+// ######################## EEPROM #########################
+
+void halEepromRead(void *data, uint16_t offset, uint16_t size) {
+  eepromUpdate();
+  memcpy(data, hostEeprom + offset, size);
+}
+
+void halEepromUpdate(uint16_t offset, uint8_t value) {
+  eepromUpdate();
+  if (eepromBusy) {
+    hostSpend(eepromDone - hostTime);
+    eepromUpdate();
+  }
+  if (hostEeprom[offset] != value) {
+    halEepromWrite(offset, value);
+  }
+}
+
+void halEepromWrite(uint16_t offset, uint8_t value) {
+  eepromAddress = offset;
+  eepromData = value;
+  eepromBusy = true;
+  eepromDone = hostTime + HOST_EEPROM_WRITE_US;
+  hostEepromWrites++;
+  eepromSchedule();
+}
+
+// Polled while busy: every poll takes a microsecond
+boolean halEepromReady() {
+  eepromUpdate();
+  if (eepromBusy) {
+    hostSpend(1);
+    eepromUpdate();
+  }
+  return !eepromBusy;
+}
+
+void halEepromInterrupt(boolean enable) {
+  eepromInterrupt = enable;
+  eepromSchedule();
+}
+
+boolean hostEepromLoad(const char *path) {
+  FILE *file = fopen(path, "rb");
+  boolean loaded;
+
+  eepromAllocate();
+  if (file == NULL) {
+    return false;
+  }
+  loaded = fread(hostEeprom, 1, HOST_EEPROM_SIZE, file) == HOST_EEPROM_SIZE;
+  fclose(file);
+  return loaded;
+}
+
+boolean hostEepromSave(const char *path) {
+  FILE *file = fopen(path, "wb");
+  boolean saved;
+
+  if (file == NULL) {
+    return false;
+  }
+  saved = fwrite(hostEeprom, 1, HOST_EEPROM_SIZE, file) == HOST_EEPROM_SIZE;
+  return fclose(file) == 0 && saved;
+}
+
+// ##################### Power and sleep #####################
+
+void halPowerSenseInit() {
+  comparatorOn = true;
+}
+
+boolean halPowerGood() {
+  return powerGood;
+}
+
+void hostPowerFail() {
+  powerGood = false;
+  if (comparatorOn) {
+    due[SRC_COMPARATOR] = hostTime;
+  }
+}
+
+void hostPowerFailAt(uint64_t us) {
+  if (comparatorOn) {
+    due[SRC_COMPARATOR] = us;
+  }
+}
+
+void hostPowerOffAt(uint64_t us) {
+  powerOffTime = us;
+}
+
+void hostPowerRestore() {
+  powerGood = true;
+  powerOffTime = NEVER;
+}
+
+void halMark(uint8_t value) {
+}
+
+// Until the first event due, or a byte received (the RX interrupt). In realtime
+// the wall clock catches up with the simulated time first.
+void halSleep() {
+  uint8_t source;
+
+  SREG |= 0x80;
+  source = nextSource();
+  if (due[source] > hostTime) {
+    if (serialRxCount() > 0) {
+      hostWakeups++;
+      return;
+    }
+    if (due[source] == NEVER) {
+      fprintf(stderr, "halSleep: no interrupt source left\n");
+      exit(2);
+    }
+    if (hostRealtime) {
+      uint64_t wall;
+
+      if (!realStarted) {
+        realStart = hostWallClock() - hostTime;
+        realStarted = true;
+      }
+      while ((wall = hostWallClock() - realStart) < due[source]) {
+        struct pollfd input = { ptyMaster, POLLIN, 0 };
+        int wait = (due[source] - wall + 999) / 1000;
+
+        if (ptyMaster >= 0 && poll(&input, 1, wait) > 0 && serialRxCount() > 0) {
+          hostSleepTime += wall - hostTime;
+          hostTime = wall;
+          hostWakeups++;
+          return;
+        }
+        if (ptyMaster < 0) {
+          usleep(due[source] - wall);
+        }
+      }
+    }
+    hostSleepTime += due[source] - hostTime;
+    hostTime = due[source];
+  }
+  serve(source);
+  hostWakeups++;
+}
+
+// ################### Pins, time and serial ##################
+
+void halPinOutput(uint8_t pin) {
+}
+
+void halPinWrite(uint8_t pin, uint8_t level) {
+  if (hostPin[pin] != level) {
+    hostPin[pin] = level;
+    if (hostPinHook != NULL) {
+      hostPinHook(pin, level);
+    }
+  }
+}
+
+unsigned long halMillis() {
+  return hostTime / 1000;
+}
+
+unsigned long halMicros() {
+  return hostTime;
+}
+
+void halSerialBegin(unsigned long baud) {
+}
+
+int halSerialRead() {
+  if (serialRxCount() == 0) {
+    return -1;
+  }
+  return serialRx[serialRxTail++];
+}
+
+int halSerialAvailable() {
+  return serialRxCount();
+}
+
+int halSerialRoom() {
+  serialTxUpdate();
+  return HOST_SERIAL_TX_BUFFER - 1 - serialTxQueued;
+}
+
+// The bytes reach the pty or hostSerialOutput at once, the TX buffer empties in time
+void halSerialWrite(const uint8_t *data, uint8_t size) {
+  for (uint8_t i = 0; i < size; i++) {
+    serialTxUpdate();
+    while (serialTxQueued >= HOST_SERIAL_TX_BUFFER - 1) {
+      hostSpend(serialTxDone - hostTime);
+      serialTxUpdate();
+    }
+    if (serialTxQueued++ == 0) {
+      serialTxDone = hostTime + HOST_SERIAL_BYTE_US;
+    }
+    serialTxComplete = false;
+    serialTxUpdate();
+
+    if (ptyMaster >= 0) {
+      if (write(ptyMaster, &data[i], 1) != 1) {
+        perror("pty write");
+      }
+    } else if (hostSerialOutputLength < HOST_SERIAL_OUTPUT) {
+      hostSerialOutput[hostSerialOutputLength++] = data[i];
+    }
+    if (hostSerialEcho != NULL) {
+      fputc(data[i], hostSerialEcho);
+    }
+  }
+}
+
+// The byte being shifted out counts in serialTxQueued
+boolean halSerialTxEmpty() {
+  serialTxUpdate();
+  return serialTxQueued <= 1;
+}
+
+void halSerialTxInterrupt(boolean enable) {
+  serialTxInterrupt = enable;
+  serialTxUpdate();
+}
+
+void halPrint(const char *text) {
+  halSerialWrite((const uint8_t *) text, strlen(text));
+}
+
+void halPrint(char c) {
+  halSerialWrite((const uint8_t *) &c, 1);
+}
+
+void halPrint(long value) {
+  char text[24];
+
+  snprintf(text, sizeof(text), "%ld", value);
+  halPrint(text);
+}
+
+void halPrint(unsigned long value) {
+  char text[24];
+
+  snprintf(text, sizeof(text), "%lu", value);
+  halPrint(text);
+}
+
+void halPrintln() {
+  halPrint("\r\n");
+}
+
+void hostSerialInput(const uint8_t *data, uint16_t size) {
+  for (uint16_t i = 0; i < size && (uint8_t) (serialRxHead - serialRxTail) < 255; i++) {
+    serialRx[serialRxHead++] = data[i];
+  }
+}
+
+// Raw slave side kept open: no echo, and no hangup when a tool closes it
+const char *hostSerialPty() {
+  struct termios tio;
+  int master = posix_openpt(O_RDWR | O_NOCTTY);
+
+  if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+    return NULL;
+  }
+  snprintf(ptyName, sizeof(ptyName), "%s", ptsname(master));
+  ptySlave = open(ptyName, O_RDWR | O_NOCTTY);
+  if (ptySlave < 0 || tcgetattr(ptySlave, &tio) != 0) {
+    return NULL;
+  }
+  cfmakeraw(&tio);
+  tcsetattr(ptySlave, TCSANOW, &tio);
+  fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+  ptyMaster = master;
+  return ptyName;
+}
+
+int hostIsolated(int (*run)()) {
+  int status;
+  pid_t pid;
+
+  fflush(stdout);
+  fflush(stderr);
+  pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    return -1;
+  }
+  if (pid == 0) {
+    int result = run();
+
+    fflush(stdout);
+    _exit(result);
+  }
+  if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status)) {
+    return -1;
+  }
+  return WEXITSTATUS(status);
+}
@@ -0,0 +1,241 @@
+/*
+ *  This file is part of ScoreBoard project.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * ScoreBoard HOST build: the firmware on Linux.
+ *
+ * main.cpp built with -DHOST includes this file instead of the Arduino and
+ * avr-libc headers: the few names of them the program uses outside the
+ * hardware abstraction layer, and the hal* functions, implemented by
+ * Host/host.cpp on a simulated board. The board time is simulated too: it
+ * only moves while the firmware sleeps or waits for a peripheral, so every run
+ * is deterministic and a whole game takes a fraction of a second (see
+ * Host/sim.h and the makefile "host", "sim" and "test" targets).
+ */
+
+#ifndef HOST_H
+#define HOST_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// ################ Arduino and avr-libc names ###############
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH                    1
+#define LOW                     0
+
+// Program memory is data memory
+#define PROGMEM
+#define PSTR(text)              (text)
+#define pgm_read_byte(address)  (*(const uint8_t *) (address))
+#define pgm_read_word(address)  (*(const uint16_t *) (address))
+#define memcpy_P                memcpy
+#define strcpy_P                strcpy
+#define strncpy_P               strncpy
+
+#define _BV(bit)                (1 << (bit))
+#define constrain(value, low, high) ((value) < (low) ? (low) : ((value) > (high) ? (high) : (value)))
+#define clockCyclesPerMicrosecond() 16
+
+// Status register: only the global interrupt flag (bit 7). sei raises the
+// interrupts that came due while disabled.
+extern uint8_t SREG;
+void cli();
+void sei();
+
+uint16_t _crc_ccitt_update(uint16_t crc, uint8_t data);
+
+// ############ Hardware abstraction layer (main.cpp) ###########
+
+void halTimer1Init(uint16_t top);
+void halTimer1Run(boolean run);
+void halTimer1Restart();
+void halAdcInit(uint8_t channel, uint8_t digitalInputs);
+void halAdcSelect(uint8_t channel);
+void halSpiInit();
+void halSpiWrite(byte value);
+void halBusShift(uint8_t dataMask, uint8_t clockMask, uint8_t bits);
+void halEepromRead(void *data, uint16_t offset, uint16_t size);
+void halEepromUpdate(uint16_t offset, uint8_t value);
+void halEepromWrite(uint16_t offset, uint8_t value);
+boolean halEepromReady();
+void halEepromInterrupt(boolean enable);
+void halPwmInit(boolean inverted);
+void halPwmDuty(uint8_t duty);
+void halPwmOutput(boolean connect);
+void halPwmInterrupt(boolean enable);
+void halPowerSenseInit();
+boolean halPowerGood();
+void halMark(uint8_t value);
+void halSleep();
+void halPinOutput(uint8_t pin);
+void halPinWrite(uint8_t pin, uint8_t level);
+void halShiftOut(uint8_t dataPin, uint8_t clockPin, uint8_t value);
+unsigned long halMillis();
+unsigned long halMicros();
+void halSerialBegin(unsigned long baud);
+int halSerialRead();
+int halSerialAvailable();
+int halSerialRoom();
+void halSerialWrite(const uint8_t *data, uint8_t size);
+boolean halSerialTxEmpty();
+void halSerialTxInterrupt(boolean enable);
+void halPrint(const char *text);
+void halPrint(char c);
+void halPrint(long value);
+void halPrint(unsigned long value);
+void halPrintln();
+
+// Numbers as the core prints them: char is a character, the others are numbers
+inline void halPrint(unsigned char value) {
+  halPrint((unsigned long) value);
+}
+
+inline void halPrint(int value) {
+  halPrint((long) value);
+}
+
+inline void halPrint(unsigned int value) {
+  halPrint((unsigned long) value);
+}
+
+template<class T> inline void halPrintln(T value) {
+  halPrint(value);
+  halPrintln();
+}
+
+// ###################### Simulated board #####################
+
+// Interrupt vectors, served by hostInterrupt (main.cpp)
+#define HOST_TIMER1_COMPA       0
+#define HOST_ADC                1
+#define HOST_EE_READY           2
+#define HOST_SPI_STC            3
+#define HOST_TIMER2_OVF         4
+#define HOST_ANALOG_COMP        5
+#define HOST_USART_TX           6
+
+void hostInterrupt(uint8_t vector, uint16_t value);
+
+// Pins of the Arduino UNO, the EEPROM of the ATmega328P, and digits kept by the
+// display model for every data pin (longer than any chain)
+#define HOST_PINS               20
+#define HOST_EEPROM_SIZE        1024
+#define HOST_CHAIN_DIGITS       16
+
+// Peripheral timings (us): one ADC conversion at 125 kHz, one SPI byte at
+// 125 kHz, one EEPROM byte write, one serial byte at 115200 baud, one byte
+// of bit bang shiftOut (digitalWrite based) and the Timer0 and Timer2 cycles
+#define HOST_ADC_US             104
+#define HOST_SPI_BYTE_US        64
+#define HOST_EEPROM_WRITE_US    3400
+#define HOST_SERIAL_BYTE_US     87
+#define HOST_SHIFT_OUT_US       85
+#define HOST_TIMER_CYCLE_US     1024
+
+// Serial TX buffer of the core (one byte is always kept free), and bytes kept
+// in hostSerialOutput
+#define HOST_SERIAL_TX_BUFFER   64
+#define HOST_SERIAL_OUTPUT      32768
+
+// Hardware SPI data output (MOSI): the display chain of the DISPLAY_SPI build
+#define HOST_SPI_MOSI           11
+
+// Simulated time since reset (us)
+extern uint64_t hostTime;
+
+// Board at reset: peripherals stopped, pins low, display dark, nothing on the
+// serial interface. The EEPROM keeps its contents.
+void hostPowerOn();
+
+// Spend "us" in the firmware (a blocking wait): the interrupts coming due meanwhile
+// are raised if enabled
+void hostSpend(uint32_t us);
+
+// Pins: last level written, and a hook called on every change
+extern uint8_t hostPin[HOST_PINS];
+extern void (*hostPinHook)(uint8_t pin, uint8_t level);
+
+// Analog inputs: the level of every channel (0-1023), or the value returned by
+// "hostAdcSource" when set, sampled at the start of every conversion
+extern uint16_t hostAdcLevel[8];
+extern uint16_t (*hostAdcSource)(uint8_t channel);
+
+// Display chains, one for every data pin: digits shifted in (digit 0 the last
+// one, the nearest to the board) and digits shown, latched when the outputs
+// are enabled. "hostFrameHook" is called on every frame shown.
+extern uint8_t hostChain[HOST_PINS][HOST_CHAIN_DIGITS];
+extern uint8_t hostShown[HOST_PINS][HOST_CHAIN_DIGITS];
+extern boolean hostDisplayOn;
+extern uint8_t hostPwmDuty;
+extern uint32_t hostFrames;
+extern uint64_t hostFirstFrameTime;
+extern void (*hostFrameHook)();
+
+// EEPROM contents (shared with the child processes of hostIsolated) and bytes
+// written since the power on
+extern uint8_t *hostEeprom;
+extern uint32_t hostEepromWrites;
+
+// Load and save the EEPROM contents: false if the file cannot be read or written
+boolean hostEepromLoad(const char *path);
+boolean hostEepromSave(const char *path);
+
+// Serial interface: bytes received (queued by hostSerialInput, or from the pty),
+// and bytes sent, kept in hostSerialOutput (cleared by the caller) and copied to
+// "hostSerialEcho" if set
+void hostSerialInput(const uint8_t *data, uint16_t size);
+extern char hostSerialOutput[];
+extern uint16_t hostSerialOutputLength;
+extern FILE *hostSerialEcho;
+
+// Serial interface on a new pseudo terminal, for host tools and tests: returns
+// the path of its slave side, NULL on error
+const char *hostSerialPty();
+
+// Supply falling below the sense threshold (the analog comparator interrupt
+// fires), now or at the simulated time "us" (in the middle of a frame, for
+// example), or back. From "hostPowerOffAt" on, the end of the hold-up time, the
+// EEPROM writes are lost.
+void hostPowerFail();
+void hostPowerFailAt(uint64_t us);
+void hostPowerOffAt(uint64_t us);
+void hostPowerRestore();
+
+// Simulated time paced on the wall clock (a board on a pty for the host tools)
+extern boolean hostRealtime;
+
+// Wall clock (us, monotonic), for the run statistics
+uint64_t hostWallClock();
+
+// Statistics: interrupts raised, halSleep returns, time asleep (us)
+extern uint32_t hostInterrupts;
+extern uint32_t hostWakeups;
+extern uint64_t hostSleepTime;
+
+// Run "run" in a child process, from the state of the firmware variables at
+// the call (before setup: a board at reset), sharing the EEPROM: returns the
+// value returned by "run" in the child, -1 if it crashed. A power cycle, for the
+// firmware variables.
+int hostIsolated(int (*run)());
+
+#endif
@@ -0,0 +1,239 @@
+/*
+ *  This file is part of ScoreBoard project.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * ScoreBoard game simulator (HOST build).
+ *
+ * Runs the firmware on the simulated board of Host/host.cpp, playing a script
+ * of timed button presses and serial lines, and prints the display at the
+ * script "show" lines and at the end, with the loop statistics. The script
+ * lines are "ms command [argument]", in time order, "#" starts a comment:
+ *   press BUTTON     short press (HOME_P1 ... SETUP_MODE, see main.cpp)
+ *   hold BUTTON      held press (HELD_TIME)
+ *   unplug, plug     control panel cable
+ *   serial TEXT      one line on the serial interface (REMOTE and LINK builds)
+ *   power off, on    supply below and back above the sense threshold
+ *   show             print the display
+ *   expect TEXT      check the display (as printed by show, trailing blanks
+ *                    ignored), the exit status is 1 if any check failed
+ *   end              stop
+ * With "-v" every frame is printed, with "-e file" the EEPROM is loaded from
+ * the file (if any) and saved to it at the end. With "-p" the serial interface
+ * is a pty (its path is printed) and the time runs on the wall clock, without
+ * a script: a board for Tools/link_panel.cpp or a serial terminal.
+ *
+ * Build: make host (see the makefile)
+ * Usage: scoreboard_sim [-v] [-e eeprom.bin] game_script.txt
+ *        scoreboard_sim -p [-e eeprom.bin]
+ */
+
+#include "../main.cpp"
+#include "sim.h"
+
+struct SimButton {
+  const char *name;
+  uint8_t id;
+};
+
+static const SimButton simButtons[] = {
+  { "HOME_P1", HOME_P1 }, { "HOME_P2", HOME_P2 }, { "HOME_P3", HOME_P3 }, { "HOME_M1", HOME_M1 },
+  { "AWAY_P1", AWAY_P1 }, { "AWAY_P2", AWAY_P2 }, { "AWAY_P3", AWAY_P3 }, { "AWAY_M1", AWAY_M1 },
+  { "TIMER_START_STOP", TIMER_START_STOP }, { "TIMER_RESET", TIMER_RESET },
+  { "PERIOD_P1", PERIOD_P1 }, { "SETUP_MODE", SETUP_MODE } };
+
+static boolean verbose = false;
+
+static uint8_t buttonId(const char *name) {
+  for (uint8_t i = 0; i < sizeof(simButtons) / sizeof(simButtons[0]); i++) {
+    if (strcmp(simButtons[i].name, name) == 0) {
+      return simButtons[i].id;
+    }
+  }
+  return 0;
+}
+
+static void printTime(uint64_t us) {
+  printf("%3u:%02u.%03u", (unsigned) (us / 60000000), (unsigned) (us / 1000000 % 60),
+      (unsigned) (us / 1000 % 1000));
+}
+
+// Length of "text" without the trailing blanks
+static size_t trimmedLength(const char *text) {
+  size_t length = strlen(text);
+
+  while (length > 0 && (text[length - 1] == ' ' || text[length - 1] == '\r')) {
+    length--;
+  }
+  return length;
+}
+
+static void printFrame() {
+  printTime(hostTime);
+  printf("  [%s]\n", simDisplay());
+}
+
+// Execute one script line: false on a malformed one
+static boolean scriptLine(char *line, int number) {
+  char command[16];
+  char argument[64];
+  unsigned long ms;
+  int fields;
+
+  argument[0] = 0;
+  fields = sscanf(line, "%lu %15s %63[^\n]", &ms, command, argument);
+  if (fields < 2) {
+    return false;
+  }
+  simRunUntil(ms * 1000ULL);
+
+  if (strcmp(command, "press") == 0 || strcmp(command, "hold") == 0) {
+    uint8_t id = buttonId(argument);
+
+    if (id == 0) {
+      return false;
+    }
+    if (command[0] == 'p') {
+      simPress(id);
+    } else {
+      simHold(id);
+    }
+  } else if (strcmp(command, "unplug") == 0 || strcmp(command, "plug") == 0) {
+    simUnplugged = command[0] == 'u';
+  } else if (strcmp(command, "serial") == 0) {
+    simSerial(argument);
+  } else if (strcmp(command, "power") == 0) {
+    if (strcmp(argument, "off") == 0) {
+      hostPowerFail();
+    } else {
+      hostPowerRestore();
+    }
+  } else if (strcmp(command, "show") == 0) {
+    printFrame();
+  } else if (strcmp(command, "expect") == 0) {
+    const char *display = simDisplay();
+    size_t length = trimmedLength(display);
+
+    if (length != trimmedLength(argument) || strncmp(display, argument, length) != 0) {
+      printf("line %d: display [%s], expected [%s]\n", number, display, argument);
+      simFailures++;
+    }
+  } else if (strcmp(command, "end") != 0) {
+    return false;
+  }
+  return true;
+}
+
+static void frameHook() {
+  if (verbose) {
+    printFrame();
+  }
+}
+
+int main(int argc, char *argv[]) {
+  const char *eepromFile = NULL;
+  const char *scriptFile = NULL;
+  boolean pty = false;
+  FILE *script;
+  char line[128];
+  int number = 0;
+  uint64_t start;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-v") == 0) {
+      verbose = true;
+    } else if (strcmp(argv[i], "-p") == 0) {
+      pty = true;
+    } else if (strcmp(argv[i], "-e") == 0 && i + 1 < argc) {
+      eepromFile = argv[++i];
+    } else {
+      scriptFile = argv[i];
+    }
+  }
+  if (scriptFile == NULL && !pty) {
+    fprintf(stderr, "Usage: %s [-v] [-e eeprom.bin] game_script.txt\n"
+        "       %s -p [-e eeprom.bin]\n", argv[0], argv[0]);
+    return 2;
+  }
+
+  hostPowerOn();
+  if (eepromFile != NULL) {
+    hostEepromLoad(eepromFile);
+  }
+  hostFrameHook = frameHook;
+
+  if (pty) {
+    const char *path = hostSerialPty();
+
+    if (path == NULL) {
+      perror("pty");
+      return 2;
+    }
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    printf("Serial interface on %s\n", path);
+    hostRealtime = true;
+    verbose = true;
+    simBoot();
+    for (;;) {
+      simRun(1000);
+      if (eepromFile != NULL) {
+        hostEepromSave(eepromFile);
+      }
+    }
+  }
+
+  script = fopen(scriptFile, "r");
+  if (script == NULL) {
+    perror(scriptFile);
+    return 2;
+  }
+  hostSerialEcho = verbose ? stdout : NULL;
+
+  start = hostWallClock();
+  simBoot();
+  while (fgets(line, sizeof(line), script) != NULL) {
+    char *p = line;
+
+    number++;
+    while (*p == ' ' || *p == '\t') {
+      p++;
+    }
+    if (*p == '#' || *p == '\n' || *p == 0) {
+      continue;
+    }
+    if (!scriptLine(p, number)) {
+      fprintf(stderr, "%s:%d: malformed line\n", scriptFile, number);
+      return 2;
+    }
+    if (strncmp(p + strspn(p, "0123456789 "), "end", 3) == 0) {
+      break;
+    }
+  }
+  fclose(script);
+
+  printFrame();
+  printf("Simulated ");
+  printTime(hostTime);
+  printf(" in %lu ms: %u frames, %u loop passes, %u wakeups, %u interrupts, %u EEPROM bytes written\n",
+      (unsigned long) ((hostWallClock() - start) / 1000), hostFrames, simPasses, hostWakeups,
+      hostInterrupts, hostEepromWrites);
+
+  if (eepromFile != NULL && !hostEepromSave(eepromFile)) {
+    perror(eepromFile);
+    return 2;
+  }
+  return simFailures == 0 ? 0 : 1;
+}
@@ -0,0 +1,213 @@
+/*
+ *  This file is part of ScoreBoard project.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * ScoreBoard HOST build: game simulation helpers for Host/sim.cpp and the
+ * tests in Test/. Included after main.cpp, in the same translation unit, to
+ * see the firmware variables: the button ladders are driven through the
+ * simulated ADC, the display is read back from the simulated chain.
+ */
+
+#ifndef SIM_H
+#define SIM_H
+
+// Loop passes without any simulated time going by, before giving up on a
+// loop that never sleeps
+#define SIM_STUCK_PASSES        100000
+
+// Button press length (ms), and wait after the release for the debouncer
+#define SIM_PRESS_TIME          100
+#define SIM_RELEASE_TIME        (DEBOUNCE_TIME * 2)
+
+// Failed checks, for the exit status of a test
+int simFailures = 0;
+
+#define SIM_CHECK(condition) \
+  simCheck(condition, #condition, __FILE__, __LINE__)
+
+#define SIM_CHECK_EQUAL(actual, expected) \
+  simCheckEqual((long) (actual), (long) (expected), #actual, __FILE__, __LINE__)
+
+void simCheck(boolean condition, const char *text, const char *file, int line) {
+  if (!condition) {
+    printf("%s:%d: check failed: %s\n", file, line, text);
+    simFailures++;
+  }
+}
+
+void simCheckEqual(long actual, long expected, const char *text, const char *file, int line) {
+  if (actual != expected) {
+    printf("%s:%d: check failed: %s is %ld, expected %ld\n", file, line, text, actual, expected);
+    simFailures++;
+  }
+}
+
+// Exit status of a test, after its name and result
+int simReport(const char *name) {
+  printf("%s: %s\n", name, simFailures == 0 ? "passed" : "FAILED");
+  return simFailures == 0 ? 0 : 1;
+}
+
+// Button held down on every analog input (0 for none), and control panel cable
+// unplugged: floating inputs
+uint8_t simHeld[ADC_INPUTS];
+boolean simUnplugged = false;
+uint32_t simNoise = 1;
+
+// Analog input of a button id (ADC_HOME, ADC_AWAY, ADC_TIMER)
+uint8_t simInput(uint8_t id) {
+  return id < AWAY_P1 ? ADC_HOME : (id < TIMER_START_STOP ? ADC_AWAY : ADC_TIMER);
+}
+
+// Ladder value of the button: the middle of its bAVal range
+uint16_t simButtonValue(uint8_t id) {
+  uint8_t b = (id - HOME_P1) % LADDER_BUTTONS;
+
+  return (pgm_read_word(&bAVal[2 * b]) + pgm_read_word(&bAVal[2 * b + 1])) / 2;
+}
+
+// Floating input: anything from 100 up, deterministic
+uint16_t simFloating() {
+  simNoise = simNoise * 1103515245 + 12345;
+  return 100 + (simNoise >> 16) % 900;
+}
+
+// hostAdcSource of the simulated control panel
+uint16_t simAdc(uint8_t channel) {
+  for (uint8_t i = 0; i < ADC_INPUTS; i++) {
+    if (adcChannel[i] == channel) {
+      if (simUnplugged) {
+        return simFloating();
+      }
+      return simHeld[i] != 0 ? simButtonValue(simHeld[i]) : 0;
+    }
+  }
+  return 0;
+}
+
+// Loop passes run, and the longest time spent awake in one of them (us): the
+// simulated time of a pass minus its sleep
+uint32_t simPasses = 0;
+uint32_t simWorstPass = 0;
+
+// Power on and setup, control panel connected and released
+void simBoot() {
+  hostPowerOn();
+  memset(simHeld, 0, sizeof(simHeld));
+  hostAdcSource = simAdc;
+  setup();
+}
+
+// Loop passes up to the simulated time "us"
+void simRunUntil(uint64_t us) {
+  uint32_t stuck = 0;
+
+  while (hostTime < us) {
+    uint64_t before = hostTime;
+    uint64_t asleep = hostSleepTime;
+    uint32_t awake;
+
+    loop();
+    simPasses++;
+    awake = (hostTime - before) - (hostSleepTime - asleep);
+    if (awake > simWorstPass) {
+      simWorstPass = awake;
+    }
+    if (hostTime != before) {
+      stuck = 0;
+    } else if (++stuck == SIM_STUCK_PASSES) {
+      printf("loop stuck at %llu us\n", (unsigned long long) hostTime);
+      exit(2);
+    }
+  }
+}
+
+void simRun(uint32_t ms) {
+  simRunUntil(hostTime + ms * 1000ULL);
+}
+
+// Button down for "ms", then released until the debouncer has seen it
+void simPress(uint8_t id, uint32_t ms = SIM_PRESS_TIME) {
+  simHeld[simInput(id)] = id;
+  simRun(ms);
+  simHeld[simInput(id)] = 0;
+  simRun(SIM_RELEASE_TIME);
+}
+
+// Held action of a button
+void simHold(uint8_t id) {
+  simPress(id, HELD_TIME + SIM_PRESS_TIME);
+}
+
+// Line on the serial interface, without waiting for the answer
+void simSerial(const char *line) {
+  hostSerialInput((const uint8_t *) line, strlen(line));
+  hostSerialInput((const uint8_t *) "\n", 1);
+}
+
+// Data pin of the main display chain
+uint8_t simMainChain() {
+#ifdef DISPLAY_SPI
+  return HOST_SPI_MOSI;
+#else
+  return PIN_COM_DATA;
+#endif
+}
+
+// Character of a glyph in "font": digits first, '?' when unknown
+char simGlyphChar(const byte *font, byte glyph) {
+  static const char order[] = "0123456789 -ABCDEFGHIJLNOPQRSTUYZ=\"'[]_";
+
+  for (const char *c = order; *c != 0; c++) {
+    if (fontGlyph(font, *c) == glyph) {
+      return *c;
+    }
+  }
+  return '?';
+}
+
+// Frame shown by the main chain, decoded with the fonts of the sport layout:
+// one character per digit, followed by '.' when its decimal point is lit, groups
+// separated by '|'
+const char *simDisplay() {
+  static char text[3 * DISPLAY_MAX_DIGITS + DISPLAY_MAX_GROUPS + 1];
+  uint8_t pin = simMainChain();
+  uint8_t digit = 0;
+  uint8_t length = 0;
+
+  for (uint8_t g = 0; g < sport.layoutGroups; g++) {
+    LayoutGroup group;
+
+    memcpy_P(&group, &sport.layout[g], sizeof(group));
+    if (g > 0) {
+      text[length++] = '|';
+    }
+    for (uint8_t d = 0; d < group.digits && digit < HOST_CHAIN_DIGITS; d++) {
+      byte glyph = hostShown[pin][digit++];
+      byte dot = fontDot(group.font);
+
+      text[length++] = simGlyphChar(group.font, glyph & ~dot);
+      if (dot != 0 && (glyph & dot)) {
+        text[length++] = '.';
+      }
+    }
+  }
+  text[length] = 0;
+  return text;
+}
+
+#endif
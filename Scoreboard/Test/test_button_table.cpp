@@ -0,0 +1,335 @@
+/*
+ *  This file is part of ScoreBoard project.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * Button action table against the nested switches it replaced: every sport,
+ * in and out of setup mode, clock running and stopped, every button pressed and
+ * held, from states at the edges of the values (zero, middle, limits), must give
+ * the same game state with buttonAction and with switchAction below.
+ *
+ * switchAction is handleHomeButtons, handleAwayButtons and handleTimerButtons as
+ * they were before the table, with the later changes of the game rules in place:
+ * packed BCD scores, limits of the sport mode (sets to win, periods, minutes)
+ * instead of the basketball and volleyball constants, the next sport instead
+ * of the volleyball toggle (with an EEPROM record), the clock reset to the
+ * period length, an EEPROM record on clock stop and on every change of the sets
+ * sports values, and the brightness on TIMER_START_STOP in setup mode.
+ */
+
+#include "../main.cpp"
+#include "../Host/sim.h"
+
+// Game state compared after the action
+struct ButtonState {
+  Score bScore;
+  Score vScore;
+  Sets vSets;
+  Time time;
+  uint8_t sport;
+  boolean setupMode;
+  boolean saveEEprom;
+  boolean buzzerManCmd;
+  uint8_t brightnessLevel;
+  uint16_t sec[CD_CHANNELS];
+  uint8_t tenth[CD_CHANNELS];
+  boolean running[CD_CHANNELS];
+};
+
+void snapshot(ButtonState &state) {
+  memset(&state, 0, sizeof(state));
+  state.bScore = bScore;
+  state.vScore = vScore;
+  state.vSets = vSets;
+  state.time = time;
+  state.sport = sportIndex;
+  state.setupMode = setupMode;
+  state.saveEEprom = saveEEprom;
+  state.buzzerManCmd = buzzerManCmd;
+  state.brightnessLevel = brightnessLevel;
+  for (uint8_t c = 0; c < CD_CHANNELS; c++) {
+    state.sec[c] = countdown[c].sec;
+    state.tenth[c] = countdown[c].tenth;
+    state.running[c] = countdown[c].running;
+  }
+}
+
+void switchAction(uint8_t id, boolean held) {
+  boolean sets = setSport();
+
+  switch (id) {
+    case HOME_P1:
+      if (setupMode) {
+        printEEPROM();
+      } else if (sets) {
+        vScore.home = bcdIncrement(vScore.home);
+        saveEEprom = true;
+      } else {
+        bScore.home = bcdIncrement(bScore.home);
+        saveEEprom = true;
+      }
+      return;
+
+    case HOME_P2:
+      if (setupMode) {
+        // Profile printed by the PROFILER build only
+      } else if (sets) {
+        if (vScore.home > 0) {
+          vScore.home = bcdDecrement(vScore.home);
+          saveEEprom = true;
+        }
+      } else {
+        bScore.home = bcdIncrement(bcdIncrement(bScore.home));
+        saveEEprom = true;
+      }
+      return;
+
+    case HOME_P3:
+      if (setupMode) {
+        buzzerManCmd = true;
+      } else if (sets) {
+        if (vSets.homeSet < sport.setsToWin && vSets.awaySet < sport.setsToWin) {
+          vSets.homeSet++;
+          saveEEprom = true;
+        }
+      } else {
+        bScore.home = bcdIncrement(bcdIncrement(bcdIncrement(bScore.home)));
+        saveEEprom = true;
+      }
+      return;
+
+    case HOME_M1:
+      if (setupMode) {
+        setSportMode((sportIndex + 1) % SPORT_MODES);
+        setupMode = false;
+        saveEEprom = true;
+      } else if (sets) {
+        if (vSets.homeSet > 0) {
+          vSets.homeSet--;
+          saveEEprom = true;
+        }
+      } else if (bScore.home > 0) {
+        bScore.home = bcdDecrement(bScore.home);
+        saveEEprom = true;
+      }
+      return;
+  }
+
+  if (id <= AWAY_M1 && setupMode && sets) {
+    return;
+  }
+
+  switch (id) {
+    case AWAY_P1:
+      if (setupMode) {
+        time.min = time.min >= sport.maxMinutes ? 0 : time.min + 1;
+        setTimer();
+      } else if (sets) {
+        vScore.away = bcdIncrement(vScore.away);
+        saveEEprom = true;
+      } else {
+        bScore.away = bcdIncrement(bScore.away);
+        saveEEprom = true;
+      }
+      return;
+
+    case AWAY_P2:
+      if (setupMode) {
+        time.sec = time.sec == 59 ? 0 : time.sec + 1;
+        setTimer();
+      } else if (sets) {
+        if (vScore.away > 0) {
+          vScore.away = bcdDecrement(vScore.away);
+          saveEEprom = true;
+        }
+      } else {
+        bScore.away = bcdIncrement(bcdIncrement(bScore.away));
+        saveEEprom = true;
+      }
+      return;
+
+    case AWAY_P3:
+      if (setupMode) {
+        time.sec = time.sec == 0 ? 59 : time.sec - 1;
+        setTimer();
+      } else if (sets) {
+        if (vSets.awaySet < sport.setsToWin && vSets.homeSet < sport.setsToWin) {
+          vSets.awaySet++;
+          saveEEprom = true;
+        }
+      } else {
+        bScore.away = bcdIncrement(bcdIncrement(bcdIncrement(bScore.away)));
+        saveEEprom = true;
+      }
+      return;
+
+    case AWAY_M1:
+      if (setupMode) {
+        time.sec = (time.sec + 5) % 60;
+        setTimer();
+      } else if (sets) {
+        if (vSets.awaySet > 0) {
+          vSets.awaySet--;
+          saveEEprom = true;
+        }
+      } else if (bScore.away > 0) {
+        bScore.away = bcdDecrement(bScore.away);
+        saveEEprom = true;
+      }
+      return;
+
+    case TIMER_START_STOP:
+      if (setupMode) {
+        brightnessLevel = brightnessLevel % BRIGHTNESS_LEVELS + 1;
+        brightnessUpdate(true);
+      } else if (sets) {
+        // Nothing
+      } else if (countdown[CD_GAME].running) {
+        countdownRun(CD_GAME, false);
+        saveEEprom = true;
+      } else if (countdownRun(CD_GAME, true)) {
+        countdownRun(CD_TIMEOUT, false);
+        countdownRun(CD_INTERVAL, false);
+      }
+      return;
+
+    case TIMER_RESET:
+      if (setupMode) {
+        if (!sets) {
+          bScore.home = 0;
+          bScore.away = 0;
+        }
+      } else if (sets) {
+        if (held) {
+          vScore.home = 0;
+          vScore.away = 0;
+          saveEEprom = true;
+        }
+      } else if (!countdown[CD_GAME].running && held) {
+        resetTimer();
+        countdownSet(CD_SHOT, SHOT_CLOCK);
+      } else {
+        countdownSet(CD_SHOT, held ? SHOT_CLOCK_SHORT : SHOT_CLOCK);
+      }
+      return;
+
+    case PERIOD_P1:
+      if (setupMode) {
+        if (!sets) {
+          bScore.home = toBcd(dataEE.score.home);
+          bScore.away = toBcd(dataEE.score.away);
+          time = dataEE.time;
+          setTimer();
+        }
+      } else if (sets) {
+        vSets.actSet = vSets.actSet >= sport.periods ? 1 : vSets.actSet + 1;
+        saveEEprom = true;
+      } else {
+        time.period = time.period >= sport.periods ? 1 : time.period + 1;
+        saveEEprom = true;
+      }
+      return;
+
+    case SETUP_MODE:
+      if (!countdown[CD_GAME].running && held) {
+        setupMode = true;
+      } else if (!countdown[CD_GAME].running && setupMode) {
+        setupMode = false;
+        saveEEprom = true;
+      }
+      return;
+  }
+}
+
+// State of a test case: sport, setup mode, clock, and values at zero (0), in
+// the middle (1) or at the limits (2)
+void prepare(uint8_t mode, boolean setup, boolean running, uint8_t values) {
+  static const uint16_t scores[3] = { 0x00, 0x45, 0x99 };
+
+  setSportMode(mode);
+  setupMode = setup;
+  bScore.home = scores[values];
+  bScore.away = scores[2 - values];
+  vScore.home = scores[values] & 0x1F;
+  vScore.away = scores[2 - values] & 0x1F;
+  vSets.homeSet = values == 2 && setSport() ? sport.setsToWin : values;
+  vSets.awaySet = values == 2 && setSport() ? sport.setsToWin - 1 : 0;
+  vSets.actSet = values == 2 ? sport.periods : 1 + values;
+  time.period = values == 2 ? sport.periods : 1 + values;
+  time.min = values == 2 ? sport.maxMinutes : 5 * values;
+  time.sec = values == 2 ? 59 : (values == 1 ? 57 : 1);
+  setTimer();
+  countdownSet(CD_SHOT, SHOT_CLOCK - values);
+  countdownSet(CD_TIMEOUT, values == 1 ? TIMEOUT_TIME : 0);
+  countdownSet(CD_INTERVAL, values == 1 ? INTERVAL_TIME : 0);
+  countdownRun(CD_GAME, false);
+  countdownRun(CD_GAME, running);
+  countdownRun(CD_TIMEOUT, values == 1 && !running);
+
+  dataEE.score.home = 12;
+  dataEE.score.away = 34;
+  dataEE.time.min = 7;
+  dataEE.time.sec = 30;
+  dataEE.time.period = 2;
+
+  brightnessLevel = 1 + values;
+  saveEEprom = false;
+  buzzerManCmd = false;
+  hostSerialOutputLength = 0;
+}
+
+int main() {
+  uint16_t cases = 0;
+
+  simBoot();
+  simRun(100);
+
+  // Interrupts off: the countdowns stay where prepare puts them
+  cli();
+  for (uint8_t mode = 0; mode < SPORT_MODES; mode++) {
+    for (uint8_t setup = 0; setup < 2; setup++) {
+      for (uint8_t running = 0; running < 2; running++) {
+        for (uint8_t values = 0; values < 3; values++) {
+          for (uint8_t id = HOME_P1; id <= SETUP_MODE; id++) {
+            for (uint8_t held = 0; held < 2; held++) {
+              ButtonState expected;
+              ButtonState actual;
+
+              prepare(mode, setup, running, values);
+              switchAction(id, held);
+              snapshot(expected);
+
+              prepare(mode, setup, running, values);
+              buttonAction(id, held);
+              snapshot(actual);
+
+              if (memcmp(&expected, &actual, sizeof(expected)) != 0) {
+                printf("sport %c, setup %u, running %u, values %u: button %u, held %u differs\n",
+                    pgm_read_byte(&sportModes[mode].key), setup, running, values, id, held);
+                simFailures++;
+              }
+              cases++;
+            }
+          }
+        }
+      }
+    }
+  }
+  sei();
+
+  printf("Cases: %u\n", cases);
+  return simReport("test_button_table");
+}
@@ -0,0 +1,152 @@
+/*
+ *  This file is part of ScoreBoard project.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * Game clock timing, from 1:05 down to zero: the clock shows "MM|SS" rounded up
+ * (1:05 until a whole second elapsed), then "SS.|t" from 59.9 on, every tenth
+ * on its own frame (10 Hz). Every value must be shown within FRAME_LATENCY of
+ * its exact time after the start, and the horn must sound on zero (the shot
+ * clock is off, its horn would come first).
+ */
+
+#include "../main.cpp"
+#include "../Host/sim.h"
+
+// Clock started, and latency allowed from a clock step to its frame (us)
+#define START_TENTHS            650
+#define FRAME_LATENCY           5000
+
+#define MAX_CHANGES             (START_TENTHS + 16)
+
+// Clock groups shown, on every change
+struct Change {
+  uint64_t time;
+  char clock[16];
+};
+
+Change changes[MAX_CHANGES];
+uint16_t changeCount;
+uint64_t hornTime;
+
+void recordFrame() {
+  const char *groups = simDisplay();
+  char clock[sizeof(changes[0].clock)] = "";
+  char *end;
+
+  // The two groups after score home, score away and period
+  for (uint8_t separators = 0; separators < 3 && groups != NULL; separators++) {
+    groups = strchr(groups, '|');
+    groups = groups != NULL ? groups + 1 : NULL;
+  }
+  if (groups != NULL) {
+    strncpy(clock, groups, sizeof(clock) - 1);
+    end = strchr(clock, '|');
+    end = end != NULL ? strchr(end + 1, '|') : NULL;
+    if (end != NULL) {
+      *end = 0;
+    }
+  }
+  if (changeCount == MAX_CHANGES || (changeCount > 0 && strcmp(changes[changeCount - 1].clock, clock) == 0)) {
+    return;
+  }
+  changes[changeCount].time = hostTime;
+  strcpy(changes[changeCount].clock, clock);
+  changeCount++;
+}
+
+void recordHorn(uint8_t pin, uint8_t level) {
+  if (pin == BUZZER_OUTPUT && level == LOW && hornTime == 0) {
+    hornTime = hostTime;
+  }
+}
+
+// Tenths left shown by "clock" ("MM|SS" or "SS.|t "), -1 if none
+int16_t shownTenths(const char *clock, boolean &tenths) {
+  unsigned int left;
+  unsigned int right;
+  char end;
+
+  tenths = sscanf(clock, "%2u.|%1u %c", &left, &right, &end) == 2;
+  if (tenths) {
+    return left * 10 + right;
+  }
+  if (sscanf(clock, "%2u|%2u%c", &left, &right, &end) == 2) {
+    return (left * 60 + right) * 10;
+  }
+  return -1;
+}
+
+int main() {
+  uint64_t start;
+  int16_t previous = -1;
+  uint16_t tenthFrames = 0;
+  uint32_t worst = 0;
+
+  simBoot();
+  simRun(100);
+  countdownSet(CD_GAME, START_TENTHS / 10);
+  countdownSet(CD_SHOT, 0);
+  simRun(500);
+
+  hostFrameHook = recordFrame;
+  hostPinHook = recordHorn;
+  start = hostTime;
+  countdownRun(CD_GAME, true);
+  simRun(START_TENTHS * 100 + 1000);
+
+  SIM_CHECK(changeCount > 0 && strcmp(changes[0].clock, "01|05") == 0);
+
+  for (uint16_t i = 1; i < changeCount; i++) {
+    const Change &change = changes[i];
+    boolean tenths;
+    int16_t shown = shownTenths(change.clock, tenths);
+    uint64_t due;
+
+    // The end of the game time: a text over the clock
+    if (shown < 0) {
+      SIM_CHECK(i == changeCount - 1 && strcmp(change.clock, "EN|D ") == 0);
+      SIM_CHECK(previous == 1);
+      shown = 0;
+    } else if (tenths) {
+      // Every tenth of the last minute, in order
+      SIM_CHECK(shown < CLOCK_TENTHS_BELOW * 10);
+      SIM_CHECK_EQUAL(shown, previous - 1);
+      tenthFrames++;
+    } else {
+      // Whole seconds, in order
+      SIM_CHECK(shown >= CLOCK_TENTHS_BELOW * 10);
+      SIM_CHECK_EQUAL(shown, (previous < 0 ? START_TENTHS : previous) - 10);
+    }
+
+    due = start + (START_TENTHS - shown) * 100000ULL;
+    if (change.time < due || change.time - due > FRAME_LATENCY) {
+      printf("clock %s shown %d us after its time\n", change.clock, (int) (change.time - due));
+      simFailures++;
+    } else if (change.time - due > worst) {
+      worst = change.time - due;
+    }
+    previous = shown;
+  }
+  printf("Clock changes: %u, tenths %u, worst latency %u us\n", changeCount, tenthFrames, worst);
+  SIM_CHECK_EQUAL(tenthFrames, CLOCK_TENTHS_BELOW * 10 - 1);
+
+  // Horn on zero
+  SIM_CHECK(hornTime >= start + START_TENTHS * 100000ULL);
+  SIM_CHECK(hornTime - (start + START_TENTHS * 100000ULL) <= FRAME_LATENCY);
+
+  return simReport("test_clock_timing");
+}
@@ -0,0 +1,126 @@
+/*
+ *  This file is part of ScoreBoard project.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * EEPROM journal under random power cuts: every power cycle boots the board
+ * (a child process, sharing the EEPROM), presses score buttons at random and
+ * cuts the power at a random time, possibly in the middle of a record. The
+ * next boot must restore the newest record written completely, or the one
+ * being written if its last byte made it: never a torn one, never an older one.
+ */
+
+#include "../main.cpp"
+#include "../Host/sim.h"
+
+#include <sys/mman.h>
+
+#define POWER_CYCLES            400
+
+// Records seen by the board before the cut, shared with the parent process: the
+// last one written completely, and the one being written at the cut (if any)
+struct JournalState {
+  persistentData done;
+  persistentData last;
+  boolean cut;
+  uint32_t seed;
+};
+
+JournalState *state;
+
+uint32_t random(uint32_t range) {
+  state->seed = state->seed * 1103515245 + 12345;
+  return (state->seed >> 16) % range;
+}
+
+boolean sameRecord(const persistentData &a, const persistentData &b) {
+  return a.counter == b.counter && a.score.home == b.score.home && a.score.away == b.score.away
+      && a.time.min == b.time.min && a.time.sec == b.time.sec && a.time.period == b.time.period
+      && a.mode == b.mode && memcmp(a.vScore, b.vScore, sizeof(a.vScore)) == 0
+      && memcmp(a.vSets, b.vSets, sizeof(a.vSets)) == 0;
+}
+
+// One power cycle: 1 on a wrong restore
+int powerCycle() {
+  simBoot();
+
+  if (state->cut && !sameRecord(dataEE, state->done) && !sameRecord(dataEE, state->last)) {
+    printf("restored record %u, written %u and %u at the cut\n", dataEE.counter,
+        state->done.counter, state->last.counter);
+    return 1;
+  }
+  state->done = dataEE;
+  state->last = dataEE;
+  state->cut = true;
+
+  // Presses and random waits, shorter than one EEPROM byte write (at most one
+  // record completes in a wait), until the cut: the records are followed from
+  // the first one requested
+  boolean requested = false;
+
+  for (;;) {
+    static const uint8_t buttons[4] = { HOME_P1, HOME_M1, AWAY_P2, AWAY_M1 };
+
+    if (random(8) == 0) {
+      buttonAction(buttons[random(4)], false);
+      requested |= saveEEprom;
+    }
+    simRunUntil(hostTime + 1 + random(HOST_EEPROM_WRITE_US - 1));
+    if (!requested) {
+      continue;
+    }
+
+    // Records are never rewritten: a new one means the previous one is complete
+    if (targetEE.counter != state->last.counter) {
+      state->done = state->last;
+    }
+    state->last = targetEE;
+    if (!pendingEE) {
+      state->done = targetEE;
+    }
+    if (random(64) == 0) {
+      return 0;
+    }
+  }
+}
+
+int main() {
+  uint32_t firstCounter = 0;
+
+  state = (JournalState*) mmap(NULL, sizeof(JournalState), PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  state->cut = false;
+  state->seed = 1;
+
+  // Erased EEPROM: the first boot starts an empty journal
+  hostPowerOn();
+  memset(hostEeprom, 0xFF, HOST_EEPROM_SIZE);
+
+  for (uint16_t i = 0; i < POWER_CYCLES && simFailures == 0; i++) {
+    if (hostIsolated(powerCycle) != 0) {
+      simFailures++;
+    }
+    if (i == 0) {
+      firstCounter = state->done.counter;
+    }
+  }
+
+  // The journal went around the whole EEPROM several times
+  printf("Records written: %u\n", state->done.counter - firstCounter);
+  SIM_CHECK(state->done.counter - firstCounter > 4 * EEPROM_RECORDS);
+
+  return simReport("test_eeprom_journal");
+}
@@ -0,0 +1,118 @@
+/*
+ *  This file is part of ScoreBoard project.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * Game event log: with the ring wrapped over actions of two events, then one of
+ * a single event overwriting the first event of the oldest action, undo must
+ * step back whole actions only, down to the oldest one kept whole, and redo
+ * them all again. A clock change is undone and redone with the clock stopped
+ * only, the running clock left alone, also by the undo and redo of a score.
+ */
+
+#include "../main.cpp"
+#include "../Host/sim.h"
+
+// Two event actions logged after a single event one, wrapping the ring
+#define ACTIONS                 (LOG_SIZE + 11)
+
+// Both scores up (even actions) or down (odd ones): the home one stays 1 ahead
+void scoreAction(uint16_t action) {
+  int8_t step = action % 2 == 0 ? 1 : -1;
+
+  logBegin();
+  bScore.home = toBcd(fromBcd(bScore.home) + step);
+  bScore.away = toBcd(fromBcd(bScore.away) + step);
+  logCommit();
+}
+
+int main() {
+  uint16_t undone = 0;
+  uint16_t redone = 0;
+  uint16_t start;
+  uint16_t ran;
+  uint8_t tenth;
+
+  simBoot();
+  simRun(100);
+
+  // Home 1 ahead, then the two event actions
+  logBegin();
+  bScore.home = toBcd(1);
+  logCommit();
+  for (uint16_t a = 0; a < ACTIONS; a++) {
+    scoreAction(a);
+  }
+  SIM_CHECK_EQUAL(logCount, LOG_SIZE);
+
+  // A single event: the oldest action loses its first event, and goes
+  logBegin();
+  time.period++;
+  logCommit();
+  SIM_CHECK_EQUAL(logCount, LOG_SIZE - 1);
+
+  while (logUndo()) {
+    SIM_CHECK_EQUAL(fromBcd(bScore.home) - fromBcd(bScore.away), 1);
+    undone++;
+  }
+  SIM_CHECK_EQUAL(undone, LOG_SIZE / 2);
+  SIM_CHECK_EQUAL(logCount, 0);
+
+  while (logRedo()) {
+    SIM_CHECK_EQUAL(fromBcd(bScore.home) - fromBcd(bScore.away), 1);
+    redone++;
+  }
+  SIM_CHECK_EQUAL(redone, undone);
+  SIM_CHECK_EQUAL(fromBcd(bScore.home), ACTIONS % 2 + 1);
+  SIM_CHECK_EQUAL(time.period, 2);
+
+  // Clock set on the stopped clock, then running: no undo until stopped
+  start = countdown[CD_GAME].sec;
+  logBegin();
+  countdownSet(CD_GAME, 300);
+  logCommit();
+  countdownRun(CD_GAME, true);
+  simRun(5050);
+  ran = countdown[CD_GAME].sec;
+  SIM_CHECK(!logUndo());
+  SIM_CHECK(countdown[CD_GAME].running);
+  SIM_CHECK(ran < 300 && countdown[CD_GAME].sec == ran);
+
+  countdownRun(CD_GAME, false);
+  SIM_CHECK(logUndo());
+  SIM_CHECK_EQUAL(countdown[CD_GAME].sec, ran + start - 300);
+
+  countdownRun(CD_GAME, true);
+  SIM_CHECK(!logRedo());
+  countdownRun(CD_GAME, false);
+  SIM_CHECK(logRedo());
+  SIM_CHECK(!countdown[CD_GAME].running);
+
+  // Score undone and redone, the clock running: not set again
+  countdownRun(CD_GAME, true);
+  simRun(1250);
+  logBegin();
+  bScore.home = bcdIncrement(bScore.home);
+  logCommit();
+  ran = countdown[CD_GAME].sec;
+  tenth = countdown[CD_GAME].tenth;
+  SIM_CHECK(logUndo());
+  SIM_CHECK(logRedo());
+  SIM_CHECK(countdown[CD_GAME].running);
+  SIM_CHECK(countdown[CD_GAME].sec == ran && countdown[CD_GAME].tenth == tenth);
+
+  return simReport("test_event_log");
+}
@@ -0,0 +1,168 @@
+/*
+ *  This file is part of ScoreBoard project.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * Boot after a power loss: the first frame must come within FIRST_FRAME_LIMIT
+ * of the power on, and show the game as it was before the loss, for basketball,
+ * volleyball (score and sets) and handball (elapsed time), a new board the full
+ * period and shot clock. Every boot is a child process, from the firmware
+ * variables at reset, sharing the EEPROM. With the EEPROM at its end of life the
+ * first frame must be as fast, the warning shown after it while the buttons
+ * work.
+ */
+
+#include "../main.cpp"
+#include "../Host/sim.h"
+
+#include <sys/mman.h>
+
+// Power on to the first frame shown (us)
+#define FIRST_FRAME_LIMIT       30000
+
+// Frame shown before the power loss, shared with the child processes
+struct BootState {
+  char shown[64];
+};
+
+BootState *state;
+
+char firstFrame[64];
+
+void recordFirstFrame() {
+  if (hostFrames == 1) {
+    strncpy(firstFrame, simDisplay(), sizeof(firstFrame) - 1);
+  }
+}
+
+// Boot: the first frame shows the game before the power loss, in time. The
+// failures counted are the ones of this boot.
+void boot() {
+  simFailures = 0;
+  simBoot();
+  simRun(100);
+
+  printf("First frame at %u us: %s\n", (unsigned int) hostFirstFrameTime, firstFrame);
+  SIM_CHECK(hostFrames > 0 && hostFirstFrameTime <= FIRST_FRAME_LIMIT);
+  SIM_CHECK(strcmp(firstFrame, state->shown) == 0);
+}
+
+// The game shown at the power loss, the EEPROM record done
+int powerLoss() {
+  strcpy(state->shown, simDisplay());
+  simRun(1000);
+  return simFailures;
+}
+
+// Next sport, from setup mode
+void nextSport() {
+  setupMode = true;
+  buttonAction(HOME_M1, false);
+}
+
+// New board: basketball score, period and clock
+int newBoard() {
+  boot();
+
+  buttonAction(HOME_P3, false);
+  buttonAction(AWAY_P2, false);
+  buttonAction(PERIOD_P1, false);
+  actStartStop();
+  simRun(75300);
+  actStartStop();
+  simRun(100);
+  SIM_CHECK(strncmp(simDisplay(), "03|02|2|08|45|", 14) == 0);
+  powerLoss();
+  // The shot clock is not saved: a full one after the boot
+  strcpy(state->shown, "03|02|2|08|45|24");
+  return simFailures;
+}
+
+// Volleyball: score, sets won and actual set
+int basketball() {
+  boot();
+  SIM_CHECK_EQUAL(sport.key, 'B');
+
+  nextSport();
+  buttonAction(HOME_P1, false);
+  buttonAction(HOME_P1, false);
+  buttonAction(AWAY_P1, false);
+  buttonAction(AWAY_P3, false);
+  buttonAction(PERIOD_P1, false);
+  simRun(MESSAGE_SET_TIME + 100);
+  SIM_CHECK_EQUAL(sport.key, 'V');
+  SIM_CHECK(strcmp(simDisplay(), "02|01|2| |0|1| ") == 0);
+  return powerLoss();
+}
+
+// Handball: the clock shows the elapsed time
+int volleyball() {
+  boot();
+  SIM_CHECK_EQUAL(sport.key, 'V');
+
+  nextSport();
+  actStartStop();
+  simRun(75300);
+  actStartStop();
+  simRun(100);
+  SIM_CHECK_EQUAL(sport.key, 'H');
+  SIM_CHECK(strcmp(simDisplay(), "03|02|2|01|15") == 0);
+  return powerLoss();
+}
+
+// EEPROM worn out: a valid newest record past the write limit
+int handball() {
+  persistentData data;
+
+  boot();
+  SIM_CHECK_EQUAL(sport.key, 'H');
+
+  data = dataEE;
+  data.counter = (uint32_t) EEPROM_MAX_WRITE * EEPROM_RECORDS;
+  data.crc = crcEEPROM(data);
+  memset(hostEeprom, 0xFF, HOST_EEPROM_SIZE);
+  memcpy(hostEeprom, &data, sizeof(data));
+  return simFailures;
+}
+
+int wornOut() {
+  boot();
+  SIM_CHECK(endOfLifeEE);
+  SIM_CHECK(strncmp(simDisplay(), "EE| E|R|", 8) == 0);
+  buttonAction(HOME_P1, false);
+  simRun(MESSAGE_EE_ERROR_TIME);
+  SIM_CHECK(strcmp(simDisplay(), "04|02|2|01|15") == 0);
+  return simFailures;
+}
+
+int main() {
+  state = (BootState*) mmap(NULL, sizeof(BootState), PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+  hostFrameHook = recordFirstFrame;
+  hostPowerOn();
+  memset(hostEeprom, 0xFF, HOST_EEPROM_SIZE);
+
+  // Empty journal: a new basketball game, full period and shot clock
+  strcpy(state->shown, "00|00|1|10|00|24");
+  SIM_CHECK_EQUAL(hostIsolated(newBoard), 0);
+  SIM_CHECK_EQUAL(hostIsolated(basketball), 0);
+  SIM_CHECK_EQUAL(hostIsolated(volleyball), 0);
+  SIM_CHECK_EQUAL(hostIsolated(handball), 0);
+  SIM_CHECK_EQUAL(hostIsolated(wornOut), 0);
+
+  return simReport("test_first_frame");
+}
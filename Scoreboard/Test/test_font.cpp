@@ -0,0 +1,48 @@
+/*
+ *  This file is part of ScoreBoard project.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * Panel fonts from the canonical one: the digits must be the ones of the digit
+ * tables they replaced (gDigits7 and gDigits4), and the extra bit of the 7"
+ * display must be set for its digits 1 and 4 only.
+ */
+
+#include "../main.cpp"
+#include "../Host/sim.h"
+
+// Digit tables of the displays before the font
+const byte digits7[10] = { 1 + 2 + 4 + 8 + 16 + 32, 2 + 4 + 128, 1 + 2 + 8 + 16 + 64,
+    1 + 2 + 4 + 8 + 64, 2 + 4 + 32 + 64 + 128, 1 + 4 + 8 + 32 + 64, 1 + 4 + 8 + 16 + 32 + 64,
+    1 + 2 + 4, 1 + 2 + 4 + 8 + 16 + 32 + 64, 1 + 2 + 4 + 8 + 32 + 64 };
+const byte digits4[10] = { 2 + 4 + 8 + 16 + 32 + 64, 4 + 8, 2 + 4 + 16 + 32 + 128,
+    2 + 4 + 8 + 16 + 128, 4 + 8 + 64 + 128, 2 + 8 + 16 + 64 + 128, 2 + 8 + 16 + 32 + 64 + 128,
+    2 + 4 + 8, 2 + 4 + 8 + 16 + 32 + 64 + 128, 2 + 4 + 8 + 16 + 64 + 128 };
+
+int main() {
+  for (uint8_t d = 0; d < 10; d++) {
+    SIM_CHECK_EQUAL(pgm_read_byte(&font7['0' + d - FONT_FIRST]), digits7[d]);
+    SIM_CHECK_EQUAL(pgm_read_byte(&font4['0' + d - FONT_FIRST]), digits4[d]);
+  }
+  for (uint8_t c = 0; c < FONT_SIZE; c++) {
+    if (c + FONT_FIRST != '1' && c + FONT_FIRST != '4' && (pgm_read_byte(&font7[c]) & PANEL_7_EXTRA)) {
+      printf("'%c': extra bit of the 7\" display\n", c + FONT_FIRST);
+      simFailures++;
+    }
+  }
+
+  return simReport("test_font");
+}
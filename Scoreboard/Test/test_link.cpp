@@ -0,0 +1,214 @@
+/*
+ *  This file is part of ScoreBoard project.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * Serial panel link (LINK build), the test as the panels on the bus: a button
+ * frame is executed once and acknowledged, its repeat (ack lost) acknowledged
+ * again only, broadcast frames executed without ack, wrong CRC and other boards
+ * frames dropped. The RS-485 driver must be on for the whole ack, released by
+ * the transmit complete interrupt right after its last byte, and an ack due
+ * while the bus is busy waits for it. Silent panels end in "PAnEL Err".
+ */
+
+#define LINK
+
+#include "../main.cpp"
+#include "../Host/sim.h"
+
+#define PANEL                   0x10
+#define OTHER_PANEL             0x11
+
+// An ack frame: 6 bytes, COBS encoded, between two delimiters
+#define ACK_BYTES               (LINK_HEADER + 2 + 3)
+
+// Driver release after the last stop bit (us)
+#define RELEASE_LIMIT           100
+
+void panelFrame(uint8_t destination, uint8_t source, uint8_t type, uint8_t seq,
+    uint8_t id, boolean held, boolean wrongCrc = false);
+
+// Driver switching seen on the pin: overlapping or short acks counted
+uint64_t driverOn;
+uint8_t driverAcks;
+uint8_t driverErrors;
+boolean driverHigh = false;
+
+// Frame of the other panel coming in at the start of the next ack
+boolean busyFrame = false;
+
+void driverPin(uint8_t pin, uint8_t level) {
+  if (pin != PIN_LINK_DRIVER) {
+    return;
+  }
+  if (level == HIGH) {
+    driverErrors += driverHigh ? 1 : 0;
+    driverOn = hostTime;
+    if (busyFrame) {
+      busyFrame = false;
+      panelFrame(LINK_ADDRESS, OTHER_PANEL, LK_BUTTON, 1, AWAY_P2, false);
+    }
+  } else {
+    uint64_t span = hostTime - driverOn;
+
+    if (!driverHigh || span < ACK_BYTES * HOST_SERIAL_BYTE_US
+        || span > ACK_BYTES * HOST_SERIAL_BYTE_US + RELEASE_LIMIT) {
+      printf("driver on for %u us\n", (unsigned int) span);
+      driverErrors++;
+    }
+    driverAcks++;
+  }
+  driverHigh = level == HIGH;
+}
+
+// A frame from "source", "wrongCrc" for a collision
+void panelFrame(uint8_t destination, uint8_t source, uint8_t type, uint8_t seq,
+    uint8_t id, boolean held, boolean wrongCrc) {
+  uint8_t data[LINK_MAX_MESSAGE];
+  uint8_t frame[LINK_MAX_FRAME];
+  uint8_t size = LINK_HEADER;
+  uint16_t crc = 0xFFFF;
+  uint8_t length;
+
+  data[0] = destination;
+  data[1] = source;
+  data[2] = type;
+  data[3] = seq;
+  if (type == LK_BUTTON) {
+    data[size++] = id;
+    data[size++] = held;
+  }
+  for (uint8_t i = 0; i < size; i++) {
+    crc = _crc_ccitt_update(crc, data[i]);
+  }
+  crc ^= wrongCrc ? 0x0100 : 0;
+  data[size++] = crc & 0xFF;
+  data[size++] = crc >> 8;
+
+  frame[0] = 0;
+  length = cobsEncode(data, size, frame + 1) + 1;
+  frame[length++] = 0;
+  hostSerialInput(frame, length);
+}
+
+// Acks sent since the last call, the destination and sequence number of the
+// last one in "to" and "seq": -1 for a wrong frame
+int acks(uint8_t &to, uint8_t &seq) {
+  uint8_t data[LINK_MAX_FRAME];
+  uint8_t start = 0;
+  int count = 0;
+
+  for (uint16_t i = 0; i < hostSerialOutputLength; i++) {
+    if (hostSerialOutput[i] != 0) {
+      continue;
+    }
+    if (i > start) {
+      uint8_t size = cobsDecode((const uint8_t*) hostSerialOutput + start, i - start, data);
+      uint16_t crc = 0xFFFF;
+
+      for (uint8_t b = 0; b < size; b++) {
+        crc = _crc_ccitt_update(crc, data[b]);
+      }
+      if (size != LINK_HEADER + 2 || crc != 0 || data[1] != LINK_ADDRESS || data[2] != LK_ACK) {
+        return -1;
+      }
+      to = data[0];
+      seq = data[3];
+      count++;
+    }
+    start = i + 1;
+  }
+  hostSerialOutputLength = 0;
+  return count;
+}
+
+int main() {
+  uint8_t to = 0;
+  uint8_t seq = 0;
+
+  simBoot();
+  hostPinHook = driverPin;
+  simRun(100);
+
+  // Button, executed and acknowledged
+  panelFrame(LINK_ADDRESS, PANEL, LK_BUTTON, 10, HOME_P1, false);
+  simRun(20);
+  SIM_CHECK_EQUAL(acks(to, seq), 1);
+  SIM_CHECK(to == PANEL && seq == 10);
+  SIM_CHECK_EQUAL(bScore.home, 1);
+
+  // Ack lost: the repeat is acknowledged, not executed
+  panelFrame(LINK_ADDRESS, PANEL, LK_BUTTON, 10, HOME_P1, false);
+  simRun(20);
+  SIM_CHECK_EQUAL(acks(to, seq), 1);
+  SIM_CHECK(to == PANEL && seq == 10);
+  SIM_CHECK_EQUAL(bScore.home, 1);
+
+  // Next sequence number
+  panelFrame(LINK_ADDRESS, PANEL, LK_BUTTON, 11, HOME_P2, false);
+  simRun(20);
+  SIM_CHECK_EQUAL(acks(to, seq), 1);
+  SIM_CHECK_EQUAL(seq, 11);
+  SIM_CHECK_EQUAL(bScore.home, 3);
+
+  // Broadcast: executed, no ack
+  panelFrame(LINK_BROADCAST, PANEL, LK_BUTTON, 12, AWAY_P1, false);
+  simRun(20);
+  SIM_CHECK_EQUAL(acks(to, seq), 0);
+  SIM_CHECK_EQUAL(bScore.away, 1);
+
+  // Collision and other board: dropped
+  panelFrame(LINK_ADDRESS, PANEL, LK_BUTTON, 13, AWAY_P1, false, true);
+  panelFrame(LINK_ADDRESS + 1, PANEL, LK_BUTTON, 14, AWAY_P1, false);
+  simRun(20);
+  SIM_CHECK_EQUAL(acks(to, seq), 0);
+  SIM_CHECK_EQUAL(bScore.away, 1);
+
+  // Two panels, the second frame in while the first ack is on the bus: its
+  // ack waits for the driver release
+  busyFrame = true;
+  panelFrame(LINK_ADDRESS, PANEL, LK_HEARTBEAT, 15, 0, false);
+  simRun(20);
+  SIM_CHECK(!busyFrame);
+  SIM_CHECK_EQUAL(acks(to, seq), 2);
+  SIM_CHECK(to == OTHER_PANEL && seq == 1);
+  SIM_CHECK_EQUAL(bScore.away, 3);
+
+  // Frames of two panels at once: the newer ack only, the other panel repeats
+  panelFrame(LINK_ADDRESS, PANEL, LK_BUTTON, 16, HOME_P1, false);
+  panelFrame(LINK_ADDRESS, OTHER_PANEL, LK_BUTTON, 2, AWAY_P1, false);
+  simRun(20);
+  SIM_CHECK_EQUAL(acks(to, seq), 1);
+  SIM_CHECK(to == OTHER_PANEL && seq == 2);
+  panelFrame(LINK_ADDRESS, PANEL, LK_BUTTON, 16, HOME_P1, false);
+  simRun(20);
+  SIM_CHECK_EQUAL(acks(to, seq), 1);
+  SIM_CHECK(to == PANEL && seq == 16);
+  SIM_CHECK_EQUAL(bScore.home, 4);
+  SIM_CHECK_EQUAL(bScore.away, 4);
+
+  SIM_CHECK_EQUAL(driverAcks, 7);
+  SIM_CHECK_EQUAL(driverErrors, 0);
+  SIM_CHECK(!driverHigh && hostPin[PIN_LINK_DRIVER] == LOW);
+
+  // Panels silent: disconnected
+  SIM_CHECK(linkConnected);
+  simRun(LINK_TIMEOUT + 100);
+  SIM_CHECK(!linkConnected);
+  SIM_CHECK(strncmp(messageText, "PAnEL", 5) == 0);
+
+  return simReport("test_link");
+}
@@ -0,0 +1,70 @@
+/*
+ *  This file is part of ScoreBoard project.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * Worst case loop pass time, with the control panel connected and unplugged:
+ * the ADC samples the ladders from its interrupt, so the loop never waits for
+ * the inputs, connected or not. The same game actions run in both cases
+ * (called directly, the unplugged panel has no buttons): clock running, score
+ * change and clock stop, with its EEPROM record.
+ */
+
+#include "../main.cpp"
+#include "../Host/sim.h"
+
+// Longest pass accepted (us): a frame and an EEPROM record are well below it,
+// the blocking analogRead sequence of the unplugged panel took 24 ms
+#define WORST_PASS_LIMIT        5000
+
+// Worst pass of the game actions, after "ms" of idle
+uint32_t worstPass(uint32_t ms) {
+  simRun(ms);
+  simWorstPass = 0;
+  buttonAction(TIMER_START_STOP, false);
+  simRun(3000);
+  buttonAction(HOME_P2, false);
+  simRun(1000);
+  buttonAction(TIMER_START_STOP, false);
+  simRun(1000);
+  return simWorstPass;
+}
+
+int main() {
+  uint32_t connected;
+  uint32_t unplugged;
+
+  simBoot();
+  connected = worstPass(1000);
+  SIM_CHECK(inputEnable);
+
+  simUnplugged = true;
+  unplugged = worstPass(1000);
+  SIM_CHECK(!inputEnable);
+
+  printf("Worst pass: connected %u us, unplugged %u us\n", connected, unplugged);
+  SIM_CHECK(connected <= WORST_PASS_LIMIT);
+  SIM_CHECK_EQUAL(unplugged, connected);
+
+  // Back connected: the buttons work again
+  simUnplugged = false;
+  simRun(100);
+  SIM_CHECK(inputEnable);
+  simPress(AWAY_P3);
+  SIM_CHECK_EQUAL(bScore.away, 3);
+
+  return simReport("test_loop_time");
+}
@@ -0,0 +1,172 @@
+/*
+ *  This file is part of ScoreBoard project.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * Button input filter on noisy ADC traces: every button is pressed, and the
+ * ones with a held action held, on ladders that read with noise around the
+ * button value, single sample spikes anywhere in the 10 bit range and contact
+ * bounce at every press and release. Every press must give exactly one action,
+ * of its button, from DEBOUNCE_TIME after the contact change up to the end of
+ * the bounce plus a few ms (HELD_TIME later for a held action), with the loop
+ * idle and with the clock running (frames and EEPROM records every second).
+ */
+
+#include "../main.cpp"
+#include "../Host/sim.h"
+
+// Trace shape: noise around the button value and the released level, one spike
+// every SPIKE_INTERVAL samples at most (never two in a median triple), bounce
+// after every contact change (us)
+#define NOISE                   15
+#define RELEASED_NOISE          10
+#define SPIKE_INTERVAL          64
+#define BOUNCE_US               5000
+
+// Action latency accepted after DEBOUNCE_TIME (us): the bounce, then up to three
+// ADC rotations (one conversion every Timer0 overflow), the debouncer seeing the
+// inputs once every rotation
+#define LATENCY_SPREAD          (BOUNCE_US + 3 * ADC_SLOTS * HOST_TIMER_CYCLE_US)
+
+#define SHORT_PRESS_MS          300
+#define HELD_PRESS_MS           (HELD_TIME + 500)
+#define GAP_MS                  300
+
+struct Trace {
+  uint8_t id;                   // Button down, 0 for none
+  uint8_t contact;              // Button of the last contact change
+  uint64_t change;              // Time of the last contact change
+  uint8_t sinceSpike;
+};
+
+Trace trace[ADC_INPUTS];
+uint32_t noiseSeed = 7;
+
+// Actions seen by the ladder handlers
+uint8_t actions;
+uint8_t actionId;
+boolean actionHeld;
+uint64_t actionTime;
+
+uint32_t noise(uint32_t range) {
+  noiseSeed = noiseSeed * 1103515245 + 12345;
+  return (noiseSeed >> 16) % range;
+}
+
+uint16_t traceAdc(uint8_t channel) {
+  for (uint8_t i = 0; i < ADC_INPUTS; i++) {
+    Trace &t = trace[i];
+    uint8_t down = t.id;
+
+    if (adcChannel[i] != channel) {
+      continue;
+    }
+    if (++t.sinceSpike >= SPIKE_INTERVAL && noise(4) == 0) {
+      t.sinceSpike = 0;
+      return noise(1024);
+    }
+    if (hostTime - t.change < BOUNCE_US) {
+      down = noise(2) == 0 ? t.contact : 0;
+    }
+    if (down != 0) {
+      return simButtonValue(down) - NOISE + noise(2 * NOISE + 1);
+    }
+    return noise(RELEASED_NOISE + 1);
+  }
+  return 0;
+}
+
+void recordAction(int id, boolean held) {
+  actions++;
+  actionId = id;
+  actionHeld = held;
+  actionTime = hostTime;
+}
+
+boolean heldAction(uint8_t id) {
+  return id >= TIMER_START_STOP && (timerLadder.heldMask & _BV(id - TIMER_START_STOP));
+}
+
+// Press "id" for "ms", then release: the latency of its action after the
+// contact change (press, or release for the short action of a button with a
+// held action), 0 if wrong
+uint32_t press(uint8_t id, uint32_t ms, boolean held) {
+  Trace &t = trace[simInput(id)];
+  uint64_t contact;
+
+  actions = 0;
+  t.id = id;
+  t.contact = id;
+  t.change = hostTime;
+  contact = hostTime;
+  simRun(ms);
+
+  if (heldAction(id) && !held) {
+    contact = hostTime;
+  }
+  t.id = 0;
+  t.change = hostTime;
+  simRun(GAP_MS);
+
+  if (actions != 1 || actionId != id || actionHeld != held) {
+    printf("button %u%s: %u actions, last %u%s\n", id, held ? " held" : "", actions, actionId,
+        actionHeld ? " held" : "");
+    return 0;
+  }
+  return actionTime - contact;
+}
+
+// Every button, and every held action: latency checks
+void allButtons(const char *load) {
+  uint32_t low = UINT32_MAX;
+  uint32_t high = 0;
+
+  for (uint8_t id = HOME_P1; id <= SETUP_MODE; id++) {
+    for (uint8_t held = 0; held <= (heldAction(id) ? 1 : 0); held++) {
+      uint32_t latency = press(id, held ? HELD_PRESS_MS : SHORT_PRESS_MS, held);
+      uint32_t expected = DEBOUNCE_TIME * 1000UL + (held ? HELD_TIME * 1000UL : 0);
+
+      if (latency < expected || latency > expected + LATENCY_SPREAD) {
+        printf("%s: button %u%s, latency %u us\n", load, id, held ? " held" : "", latency);
+        simFailures++;
+      }
+      if (latency >= expected) {
+        latency -= expected;
+        low = latency < low ? latency : low;
+        high = latency > high ? latency : high;
+      }
+    }
+  }
+  printf("%s: latency DEBOUNCE_TIME + %u to %u us\n", load, low, high);
+}
+
+int main() {
+  simBoot();
+  hostAdcSource = traceAdc;
+  homeLadder.handler = recordAction;
+  awayLadder.handler = recordAction;
+  timerLadder.handler = recordAction;
+  simRun(100);
+
+  allButtons("idle");
+
+  countdownRun(CD_GAME, true);
+  allButtons("clock running");
+  SIM_CHECK(countdown[CD_GAME].running);
+  SIM_CHECK(hostEepromWrites > 0);
+
+  return simReport("test_noisy_input");
+}
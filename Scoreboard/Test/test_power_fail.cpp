@@ -0,0 +1,187 @@
+/*
+ *  This file is part of ScoreBoard project.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * Power fail (POWER_SENSE build) at every point around a frame, the clock
+ * running: from the comparator interrupt on, the displays and the horn must
+ * stay off, even for a frame being shifted out at the cut, and the last record
+ * must hold the score and the clock of the cut. The next boot (a child process,
+ * sharing the EEPROM) restores them. With the supply back before the end of the
+ * hold-up time, the displays come back. The last record must be complete
+ * within the hold-up time, also cut while the records of the score are written.
+ */
+
+#define POWER_SENSE
+
+#include "../main.cpp"
+#include "../Host/sim.h"
+
+#include <sys/mman.h>
+
+// Cuts every CUT_STEP us, from CUT_BEFORE us before the end of the probed frame
+// (the outputs enabled) to CUT_AFTER us after it
+#define CUT_BEFORE              2000
+#define CUT_AFTER               200
+#define CUT_STEP                10
+
+// Cuts every ms from the score change on (ms)
+#define RECORD_CUTS             200
+
+// Hold-up time for the last record (us), see PIN_POWER_SENSE: the records of
+// the host build have padding bytes, written too
+#define HOLD_UP_US              (80000 + (sizeof(persistentData) - 22) * HOST_EEPROM_WRITE_US)
+
+// Clock run before the probed frame, time for the last record, and supply
+// back before the end of the run (ms)
+#define GAME_TIME               3500
+#define SAVE_TIME               300
+#define RESTORE_TIME            1500
+
+// Probed frame, and the game clock (BCD) shown before it and by it, shared with
+// the child processes
+struct CutState {
+  uint64_t scoreTime;
+  uint64_t frameEnd;
+  uint16_t clockBefore;
+  uint16_t clockAfter;
+  uint64_t cut;
+  uint32_t lastCounter;
+};
+
+CutState *state;
+
+boolean lateFrame;
+
+// The game before the cut: a score, and the clock running
+void game() {
+  simBoot();
+  simRun(100);
+  buttonAction(HOME_P3, false);
+  buttonAction(AWAY_P1, false);
+  actStartStop();
+}
+
+uint16_t clockSeconds(uint16_t clock) {
+  return fromBcd(clock >> 8) * 60 + fromBcd(clock & 0xFF);
+}
+
+void probeFrame() {
+  if (countdown[CD_GAME].clock != state->clockAfter) {
+    state->clockBefore = state->clockAfter;
+    state->clockAfter = countdown[CD_GAME].clock;
+    state->frameEnd = hostTime;
+  }
+}
+
+// The score change, and the last clock change of the game and its frame
+int probe() {
+  game();
+  state->scoreTime = hostTime;
+  hostFrameHook = probeFrame;
+  simRun(GAME_TIME);
+  return state->clockBefore != 0 ? 0 : 1;
+}
+
+void checkFrame() {
+  if (!halPowerGood()) {
+    lateFrame = true;
+  }
+}
+
+// The game cut at "state->cut", the supply off at the end of the hold-up time:
+// 1 for a display or horn on while the supply is failing, 2 if not on again
+// once it is back. The EEPROM is left as at the cut.
+int cutRun() {
+  uint8_t cutEeprom[HOST_EEPROM_SIZE];
+  uint32_t frames;
+
+  game();
+  hostFrameHook = checkFrame;
+  hostPowerFailAt(state->cut);
+  hostPowerOffAt(state->cut + HOLD_UP_US);
+  simRunUntil(state->cut + SAVE_TIME * 1000ULL);
+  state->lastCounter = counterEE;
+  if (lateFrame || hostDisplayOn || hostPin[BUZZER_OUTPUT] != HIGH) {
+    return 1;
+  }
+
+  memcpy(cutEeprom, hostEeprom, HOST_EEPROM_SIZE);
+  frames = hostFrames;
+  hostPowerRestore();
+  simRun(RESTORE_TIME);
+  memcpy(hostEeprom, cutEeprom, HOST_EEPROM_SIZE);
+  return hostFrames > frames && countdown[CD_GAME].running ? 0 : 2;
+}
+
+// Boot after the cut: the last record, with the score and the clock of the cut
+int bootCheck() {
+  uint16_t saved;
+
+  simBoot();
+  if (dataEE.counter != state->lastCounter) {
+    return 3;
+  }
+  saved = dataEE.time.min * 60 + dataEE.time.sec;
+  if (dataEE.score.home != 3 || dataEE.score.away != 1) {
+    return 1;
+  }
+  return saved == clockSeconds(state->clockBefore) || saved == clockSeconds(state->clockAfter) ? 0 : 2;
+}
+
+// Cuts from "first" to "last" every "step" us
+uint16_t sweep(uint64_t first, uint64_t last, uint64_t step, uint64_t origin) {
+  uint16_t cuts = 0;
+
+  for (state->cut = first; state->cut <= last; state->cut += step) {
+    int cutResult;
+    int bootResult;
+
+    memset(hostEeprom, 0xFF, HOST_EEPROM_SIZE);
+    cutResult = hostIsolated(cutRun);
+    bootResult = cutResult == 0 ? hostIsolated(bootCheck) : 0;
+    if (cutResult != 0 || bootResult != 0) {
+      printf("cut %d us from the %s: run %d, boot %d\n", (int) (state->cut - origin),
+          origin == state->frameEnd ? "frame end" : "score change", cutResult, bootResult);
+      simFailures++;
+    }
+    cuts++;
+  }
+  return cuts;
+}
+
+int main() {
+  uint16_t cuts;
+
+  state = (CutState*) mmap(NULL, sizeof(CutState), PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  memset(state, 0, sizeof(CutState));
+
+  hostPowerOn();
+  memset(hostEeprom, 0xFF, HOST_EEPROM_SIZE);
+  SIM_CHECK_EQUAL(hostIsolated(probe), 0);
+
+  cuts = sweep(state->frameEnd - CUT_BEFORE, state->frameEnd + CUT_AFTER, CUT_STEP, state->frameEnd);
+  printf("Cuts: %u, clock %04X to %04X\n", cuts, state->clockBefore, state->clockAfter);
+
+  // The clock just started: the records of the score, from an empty journal
+  state->clockBefore = toBcd(TIMER_INIT_MIN) << 8 | toBcd(TIMER_INIT_SEC);
+  state->clockAfter = state->clockBefore;
+  cuts = sweep(state->scoreTime, state->scoreTime + RECORD_CUTS * 1000ULL, 1000, state->scoreTime);
+  printf("Cuts: %u, from the score change\n", cuts);
+
+  return simReport("test_power_fail");
+}
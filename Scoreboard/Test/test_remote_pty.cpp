@@ -0,0 +1,143 @@
+/*
+ *  This file is part of ScoreBoard project.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * Remote control commands (REMOTE build) through a pty, as an operator console
+ * sends them: every command line gets its "OK" or "ERR" answer, and its action
+ * reaches the game state and the display.
+ */
+
+#define REMOTE
+
+#include "../main.cpp"
+#include "../Host/sim.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+// Simulated time allowed for an answer (ms)
+#define ANSWER_TIME             1000
+
+int console;
+
+// Next line from the board, without the line end: NULL if none in time
+const char *readLine() {
+  static char line[64];
+  uint8_t length = 0;
+  char c;
+
+  for (uint16_t ms = 0; ms < ANSWER_TIME; ms++) {
+    struct pollfd input = { console, POLLIN, 0 };
+
+    simRun(1);
+    while (poll(&input, 1, 0) > 0 && read(console, &c, 1) == 1) {
+      if (c == '\n') {
+        line[length] = 0;
+        return line;
+      }
+      if (c != '\r' && length < sizeof(line) - 1) {
+        line[length++] = c;
+      }
+    }
+  }
+  return NULL;
+}
+
+// Send a command line and return the answer
+const char *command(const char *text) {
+  if (write(console, text, strlen(text)) != (ssize_t) strlen(text) || write(console, "\n", 1) != 1) {
+    perror("console");
+    exit(2);
+  }
+  return readLine();
+}
+
+boolean answered(const char *text, const char *answer) {
+  const char *line = command(text);
+
+  return line != NULL && strcmp(line, answer) == 0;
+}
+
+#define CHECK_ANSWER(text, answer) \
+  simCheck(answered(text, answer), text, __FILE__, __LINE__)
+
+int main() {
+  const char *path = hostSerialPty();
+
+  if (path == NULL || (console = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK)) < 0) {
+    perror("pty");
+    return 2;
+  }
+  simBoot();
+  simRun(100);
+
+  // Scores and clock
+  CHECK_ANSWER("H=12", "OK");
+  CHECK_ANSWER("A+3", "OK");
+  SIM_CHECK_EQUAL(bScore.home, 0x12);
+  SIM_CHECK_EQUAL(bScore.away, 0x03);
+  CHECK_ANSWER("C=5:30", "OK");
+  CHECK_ANSWER("P=3", "OK");
+  simRun(200);
+  SIM_CHECK(strcmp(simDisplay(), "12|03|3|05|30|24") == 0);
+
+  CHECK_ANSWER("C+", "OK");
+  simRun(2000);
+  SIM_CHECK(countdown[CD_GAME].running);
+  CHECK_ANSWER("C-", "OK");
+  SIM_CHECK(!countdown[CD_GAME].running);
+  SIM_CHECK(time.min == 5 && time.sec < 30);
+
+  // Undo of the clock stop, redo
+  CHECK_ANSWER("A=20", "OK");
+  CHECK_ANSWER("U", "OK");
+  SIM_CHECK_EQUAL(bScore.away, 0x03);
+  CHECK_ANSWER("R", "OK");
+  SIM_CHECK_EQUAL(bScore.away, 0x20);
+
+  // Malformed commands, and a line longer than the buffer
+  CHECK_ANSWER("X", "ERR");
+  CHECK_ANSWER("H=", "ERR");
+  CHECK_ANSWER("C=5:75", "ERR");
+  CHECK_ANSWER("H=1234567890123456789012345678901234567890", "ERR");
+  CHECK_ANSWER("H+1", "OK");
+  SIM_CHECK_EQUAL(bScore.home, 0x13);
+
+  // Mode switch: the sets layout
+  CHECK_ANSWER("MV", "OK");
+  SIM_CHECK_EQUAL(sport.key, 'V');
+  CHECK_ANSWER("H+1", "OK");
+  SIM_CHECK_EQUAL(vScore.home, 1);
+  CHECK_ANSWER("MB", "OK");
+
+  // EEPROM dump: title, a counter line for every record, then the answer
+  const char *line = command("E");
+  uint16_t records = 0;
+  boolean title = false;
+
+  while (line != NULL && strcmp(line, "OK") != 0) {
+    title |= strcmp(line, "####### EEPROM CONTENTS #######") == 0;
+    records += strncmp(line, "Counter = ", 10) == 0;
+    line = readLine();
+  }
+  SIM_CHECK(title);
+  SIM_CHECK_EQUAL(records, EEPROM_RECORDS);
+  SIM_CHECK(line != NULL);
+
+  return simReport("test_remote_pty");
+}
@@ -20,13 +20,14 @@
  * version 1.0.5
  */
 
+#ifdef HOST
+#include "Host/host.h"
+#else
 #include <Arduino.h>
 #include <avr/eeprom.h>
-
-#include <pnew.cpp>
-
-#include <DisplayManager.h>
-#include <AnalogButtons.h>
+#include <avr/sleep.h>
+#include <util/crc16.h>
+#endif
 
 // Analog input buttons IDs
 #define TIMER_ANALOG_INPUT      5
@@ -36,8 +37,30 @@
 // Digital outputs
 #define BUZZER_OUTPUT           8
 #define PIN_COM_DATA            2             // Data output pin: used to pass the next bit
-#define PIN_COM_CLOCK           4             // Clock output pin: used by DisplayManager to clock the data
-#define PIN_OUTPUT_ENABLE       3             // Output enable pin: set to low to enable shift register output
+#define PIN_COM_CLOCK           4             // Clock output pin: used by DisplayChain to clock the data
+#define PIN_OUTPUT_ENABLE       3             // Output enable pin (OC2B): PWM brightness of the shift register outputs
+
+// Hardware SPI output (DISPLAY_SPI build): the display chain data and clock
+// lines must be wired to MOSI and SCK instead of PIN_COM_DATA and PIN_COM_CLOCK
+#define PIN_SPI_MOSI            11
+#define PIN_SPI_SCK             13
+#define PIN_SPI_SS              10            // Not used, must be an output to keep the SPI in master mode
+
+// Power fail detection (POWER_SENSE build): the unregulated supply through a
+// divider on AIN1, compared with the 1.1 V bandgap. The divider must give more
+// than 1.1 V while the supply is good, and cross it while the regulator still
+// holds up the 5 V for the last record (80 ms with the displays off, see
+// writeEEPROM).
+#define PIN_POWER_SENSE         7             // AIN1
+
+// Bit parallel output (DISPLAY_PARALLEL build): a mirrored scoreboard and a time
+// panel on their own data lines, sharing clock and output enable with the main
+// chain. Every data line and the clock must be on PORTD (pins 0-7).
+#define PIN_MIRROR_DATA         5
+#define PIN_PANEL_DATA          6
+
+// SPI clock for the display chain: f/128 = 125 kHz, for the long cables to the displays
+#define DISPLAY_SPI_CLOCK       (_BV(SPR1) | _BV(SPR0))
 
 // Home buttons IDs
 #define HOME_P1                 1
@@ -57,46 +80,221 @@
 #define PERIOD_P1               11
 #define SETUP_MODE              12
 
-// Button held time
-#define HELD_DURATION           3
+// Button held time in ms
+#define HELD_TIME               3000
 
-// Update display interval when idle in ms
+// Display integrity refresh interval when idle in ms
 #define UPDATE_DISPLAY_INT      500
 
 // Period end horn/buzzer on time in ms
 #define BUZZER_ON_TIME          900
 #define BUZZER_ON_END_TIME      1300
 
-// Button debouncing and timer count
-#define DEBOUNCING_COUNT        75
-#define DEBOUNCING_COUNT_HOME   80
+// Horn on time in ms at the end of the shot clock, a timeout and an interval:
+// told apart from the period end
+#define BUZZER_SHOT_TIME        400
+#define BUZZER_TIMEOUT_TIME     600
+#define BUZZER_INTERVAL_TIME    1300
+
+// Button debouncing: the button read on an analog input must stay the same for
+// this time in ms
+#define DEBOUNCE_TIME           30
 #define MIN_VALID_ANALOG_VALUE  15
-#define TIMER_INIT_MIN          10L
+#define TIMER_INIT_MIN          10L           // Basketball period length
 #define TIMER_INIT_SEC          0L
 
 #define MAX_MINUTES             20
 
-#define EEPROM_MAX_WRITE        100000        // Maximum number of erase-write cycles for EVERY EEPROM cell
-#define EEPROM_SIZE             1024          // EEPROM size in bytes
+// ADC sampling: prescaler 128 (125 kHz ADC clock, ~104 us per conversion), one
+// conversion started by every Timer0 overflow (~1 ms). Every analog input gets
+// 3 sample slots filtered by their median (~9 ms for all the inputs): the
+// multiplexer settles in the time between two conversions.
+#define ADC_INPUTS              3
+#define ADC_SLOTS_PER_INPUT     3
+#define ADC_SLOTS               (ADC_INPUTS * ADC_SLOTS_PER_INPUT)
+
+// Display chain size: groups and digits (one shift register for every digit)
+#define DISPLAY_MAX_GROUPS      7
+#define DISPLAY_MAX_DIGITS      12
+
+// Display chains shifted out together (DISPLAY_PARALLEL build): main, mirror
+// and time panel
+#ifdef DISPLAY_PARALLEL
+#ifdef DISPLAY_SPI
+#error "DISPLAY_PARALLEL is a bit bang output, not available with DISPLAY_SPI"
+#endif
+#define DISPLAY_CHAINS          3
+#endif
 
-// Timer macros
-#define START_STOP_TIMER(sreg,v) \
-  sreg = SREG;\
-  cli();\
-  TCCR1B = v;\
-  SREG = sreg;
+// Sport modes, in the setup mode cycle order
+#define SPORT_BASKETBALL        0
+#define SPORT_VOLLEYBALL        1
+#define SPORT_HANDBALL          2
+#define SPORT_FUTSAL            3
+#define SPORT_TABLE_TENNIS      4
+#define SPORT_MODES             5
 
-#define RESET_TIMER_COUNTER(sreg) \
-  sreg = SREG;\
-  cli();\
-  TCNT1 = 0;\
-  SREG = sreg;
+// Groups of the clock minutes and seconds (tenths in the last minute) in the
+// time layout
+#ifdef PROTOTYPE
+#define CLOCK_LEFT_GROUP        0
+#define CLOCK_RIGHT_GROUP       1
+#else
+#define CLOCK_LEFT_GROUP        3
+#define CLOCK_RIGHT_GROUP       4
+#endif
 
-// ####################### Prototypes #######################
+// Groups of the clock in the time panel layout (DISPLAY_PARALLEL build)
+#define PANEL_CLOCK_LEFT_GROUP  0
+#define PANEL_CLOCK_RIGHT_GROUP 1
+
+// Duration of the messages shown on the display (ms)
+#define MESSAGE_SET_TIME        2000
+#define MESSAGE_EE_ERROR_TIME   10000
+#define MESSAGE_LINK_ERROR_TIME 5000
+
+// Display brightness: steps of the gamma table, operator levels (1 to
+// BRIGHTNESS_LEVELS, BRIGHTNESS_STEPS / BRIGHTNESS_LEVELS steps each) and step
+// while idle (clock stopped and no buttons for IDLE_DIM_TIME ms)
+#define BRIGHTNESS_STEPS        32
+#define BRIGHTNESS_LEVELS       4
+#define BRIGHTNESS_IDLE         11
+#define IDLE_DIM_TIME           300000UL
+
+// Fade speed: Timer2 overflows (~1 ms) for every brightness step
+#define FADE_OVERFLOWS          8
+
+// Loop events, queued by the interrupt handlers (bit mask)
+#define EVENT_TICK              0x01          // Timer1 tick
+#define EVENT_INPUT             0x02          // All the analog inputs sampled, a button in use
+#define EVENT_FRAME             0x04          // Display frame shifted out by the SPI
+#define EVENT_POWER             0x08          // Supply falling (POWER_SENSE build)
+
+// Number of frames for the display output benchmark
+#define BENCHMARK_FRAMES        100
+
+// Loop profiler (PROFILER build): histogram buckets of every phase, the first
+// one counts the durations shorter than PROFILE_BUCKET_MIN us, every other one
+// doubles the limit
+#define PROFILE_BUCKETS         8
+#define PROFILE_BUCKET_MIN      8
+
+// Game event log: events kept for undo, redo and the play-by-play dump (2
+// bytes each). Out of the 2048 bytes of RAM, estimated from the sizes of the
+// variables (not measured with avr-size): about 430 bytes of other globals and
+// 170 of the Arduino core (serial buffers), 300 more with DISPLAY_PARALLEL,
+// REMOTE and TELEMETRY together. 192 events leave about 1 kB for the stack, 750
+// bytes in that largest build.
+#define LOG_SIZE                192
+
+// Game event: bits 15-13 type, bit 12 set on the events following the first one
+// of an action, bit 11 away team, bits 10-0 signed change of the value
+#define LOG_SCORE               0             // Basketball score
+#define LOG_VSCORE              1             // Sets sports score
+#define LOG_SETS                2             // Sets won
+#define LOG_SET                 3             // Actual set
+#define LOG_PERIOD              4
+#define LOG_CLOCK               5             // Game clock seconds left (stopped)
+#define LOG_TYPES               6
+#define LOG_FIELDS              (LOG_TYPES * 2)   // Type and team
+#define LOG_LINKED              0x1000
+#define LOG_DELTA_MAX           1023
+
+#define LOG_EVENT(field, delta) ((uint16_t) ((field) >> 1) << 13 | ((field) & 1) << 11 | ((delta) & 0x07FF))
+#define LOG_TYPE(event)         ((event) >> 13)
+#define LOG_FIELD(event)        ((event) >> 13 << 1 | ((event) >> 11 & 1))
+#define LOG_DELTA(event)        ((int16_t) ((event) << 5) >> 5)
+
+// Cycle benchmark markers (SIMULATOR build), written to GPIOR0 and timed by
+// Tools/simavr_bench.cpp: start of the next phase measured, start of the loop
+// pass, or the ProfilePhase ending
+#define SIM_MARK_START          0x80
+#define SIM_MARK_LOOP           0x81
+
+#if defined(PROFILER) && defined(SIMULATOR)
+#error "PROFILER and SIMULATOR measure the same phases, build one of them"
+#endif
 
-void configureAnalogB();
+// Serial remote control (REMOTE build): maximum command length
+#define REMOTE_LINE             16
+
+// Telemetry stream (TELEMETRY build): TX ring buffer size, full state interval
+// in ms, and maximum frame size (message, CRC, COBS code and delimiter)
+#define TELEMETRY_BUFFER        64            // Power of 2
+#define TELEMETRY_KEYFRAME_INT  5000
+#define TELEMETRY_MAX_MESSAGE   8
+#define TELEMETRY_MAX_FRAME     (TELEMETRY_MAX_MESSAGE + 5)
+
+// Telemetry message types, followed by the payload (little endian)
+#define TM_SCORE                1             // home, away (uint16)
+#define TM_CLOCK                2             // seconds left (uint16), running (uint8)
+#define TM_PERIOD               3             // period (uint8)
+#define TM_VOLLEY_SCORE         4             // home, away (uint16)
+#define TM_VOLLEY_SETS          5             // actual set, home sets, away sets (uint8)
+#define TM_BUZZER               6             // on (uint8)
+#define TM_MODE                 7             // sport mode, SPORT_* (uint8)
+#define TM_SHOT_CLOCK           8             // seconds left (uint16), running (uint8)
+
+// Serial panel link (LINK build): address of this board on the bus, broadcast
+// address, panels followed at the same time, silence after which a panel is
+// disconnected (ms, the panels send a heartbeat every 250 ms when idle), and
+// maximum frame size (header, payload, CRC, COBS code and delimiters)
+#define LINK_ADDRESS            0x01
+#define LINK_BROADCAST          0xFF
+#define LINK_PANELS             4
+#define LINK_TIMEOUT            1000
+#define LINK_HEADER             4
+#define LINK_MAX_MESSAGE        (LINK_HEADER + 2)
+#define LINK_MAX_FRAME          (LINK_MAX_MESSAGE + 5)
+
+// Link message types, after destination, source, type and sequence number
+#define LK_BUTTON               1             // button ID, held (uint8)
+#define LK_HEARTBEAT            2             // no payload
+#define LK_ACK                  3             // no payload, sequence number of the acknowledged frame
+
+// RS-485 transceiver driver enable (DE and /RE tied together): high only while
+// the board sends, the bus is shared by all the panels and boards
+#define PIN_LINK_DRIVER         9
+
+#if defined(LINK) && (defined(REMOTE) || defined(TELEMETRY) || defined(PROFILER))
+#error "LINK takes the whole serial interface, build it without REMOTE, TELEMETRY and PROFILER"
+#endif
+
+#define EEPROM_MAX_WRITE        100000        // Maximum number of erase-write cycles for EVERY EEPROM cell
+#define EEPROM_SIZE             1024          // EEPROM size in bytes
+#define EEPROM_RECORDS          (EEPROM_SIZE / sizeof(persistentData))   // Journal records
+
+// Record layout version, the first byte of the CRC: the records written with
+// another layout are never valid
+#define EEPROM_LAYOUT           3
+
+// Timer1 compare value: one interrupt every tenth of second at 16 MHz / 256
+#define TIMER1_TOP              6249
+
+// Countdown channels, all decremented by the Timer1 tick. A linked channel must
+// follow its master in the order.
+#define CD_GAME                 0             // Game clock
+#define CD_SHOT                 1             // Shot clock, linked to the game clock
+#define CD_TIMEOUT              2             // Team timeout
+#define CD_INTERVAL             3             // Interval between periods and halftime
+#define CD_CHANNELS             4
+#define CD_NONE                 0xFF          // No link
+
+// Countdown lengths in seconds
+#define SHOT_CLOCK              24
+#define SHOT_CLOCK_SHORT        14
+#define TIMEOUT_TIME            60
+#define INTERVAL_TIME           120
+#define HALFTIME_TIME           900
+
+// Below this time (seconds) the clock shows seconds and tenths instead of minutes and seconds
+#define CLOCK_TENTHS_BELOW      60
 
-void setupDiplay();
+// ####################### Prototypes #######################
+
+// Start the ADC in free running mode, sampling the analog inputs from the
+// ADC conversion complete interrupt
+void configureADC();
 
   // Handle home buttons pressed
 void handleHomeButtons(int id, boolean held);
@@ -107,60 +305,311 @@ void handleAwayButtons(int id, boolean held);
 // Handle timer buttons pressed and setup mode
 void handleTimerButtons(int id, boolean held);
 
-// EEPROM wear leveling algorithm prototypes
-// Seek for the first writable cells in the EEPROM  i.e. the first cell counter
-// with value smaller than EEPROM_MAX_WRITE
+// Execute the action of the button "id" in the current mode
+void buttonAction(int id, boolean held);
+
+// Show "text" (in PROGMEM) from the display group "group" on for "duration" ms
+void showMessage(uint8_t group, const char *text, uint16_t duration);
+
+// Show the actual set for a while
+void showSetMessage();
+
+// Empty the game event log
+void logClear();
+
+// Switch to the sport mode "mode" (SPORT_*) and its display layout
+void setSportMode(uint8_t mode);
+
+// Sports counting sets instead of time (volleyball, table tennis)
+boolean setSport();
+
+// Set the game clock to time.min and time.sec, the time shown
+void setTimer();
+
+// Set the game clock to the beginning of a period
+void resetTimer();
+
+// Set the countdown "channel" to "seconds"
+void countdownSet(uint8_t channel, uint16_t seconds);
+
+// Full length of the countdown "channel" in seconds
+uint16_t countdownLength(uint8_t channel);
+
+// Start or stop the countdown "channel" together with the channels linked to
+// it: false if not possible (zero reached, linked to a stopped channel)
+boolean countdownRun(uint8_t channel, boolean run);
+
+// EEPROM journal prototypes
+// Seek for the newest valid record in the journal (binary search over the
+// sequence numbers): returns false on EEPROM end of life
 boolean initializeEEPROM();
 
-// Write to the EEPROM cell with offset "offsetEE" and counter "counterEE" the
-// actual value of score and time variables.
-boolean writeEEPROM();
+// Append to the journal, after the record at offset "offsetEE", a record with
+// sequence number "counterEE" + 1 and the actual value of score and time
+// variables. The write is only queued: the EEPROM ready interrupt writes the
+// bytes that differ from the old record in the same cell, the record after
+// the one being written if any. The "last" record (power fail) takes the place
+// of the one being written instead.
+boolean writeEEPROM(boolean last);
 
-// Read from the EEPROM cell with offset "offsetEE" and counter "counterEE" the
-// stored value of score and time variables.
+// Read from the EEPROM record with offset "offsetEE" the stored value of
+// score and time variables.
 void readEEPROM();
 
+// Read a block from EEPROM, holding the background writer meanwhile
+void readEEPROMBlock(void *data, uint16_t offset, uint16_t size);
+
 // Prints on the serial interface the contents of all the EEPROM cells
 void printEEPROM();
 
 // Buzzer managament: end of period or manual activation
-void buzzer(boolean activation);
+void buzzer(unsigned long onTime);
+
+#ifdef PROFILER
+// Prints on the serial interface the loop phases statistics, then reset them
+void printProfile();
+#endif
+
+#ifdef REMOTE
+// Read the commands received on the serial interface and execute the complete ones
+void remoteControl();
+#endif
+
+#ifdef TELEMETRY
+// Queue the telemetry frames of the state changed since the last call (all of
+// them every TELEMETRY_KEYFRAME_INT ms) and send what the serial TX buffer can
+// take without waiting
+void telemetry(uint16_t gameLocal, uint16_t shotLocal);
+#endif
+
+#ifdef LINK
+// Decode the frames received from the panels on the bus, execute and acknowledge
+// them, and disconnect the panels silent for LINK_TIMEOUT ms
+void linkControl();
+#endif
+
+// Interrupt handlers, called by the ISRs of the hardware abstraction layer
+// Timer1 compare match: one tenth of second elapsed
+inline void onTimerTick();
+
+// ADC conversion complete with "value"
+inline void onAdcComplete(uint16_t value);
+
+// EEPROM ready for the next byte
+inline void onEepromReady();
+
+// SPI byte shifted out
+inline void onSpiComplete();
+
+// Timer2 overflow, during a brightness fade
+inline void onPwmOverflow();
+
+// Analog comparator: supply below the power fail threshold
+inline void onPowerFail();
+
+// USART transmit complete: the last byte written is out, stop bit included
+inline void onSerialTxComplete();
 
 
 // ######################## Constants ########################
 
 // Analog input values read from digital buttons
 #ifdef PROTOTYPE
-const uint16_t bAVal[10] = { 65, 100, 125, 160, 240, 300, 340, 385 };
+const uint16_t bAVal[8] PROGMEM = { 65, 100, 125, 160, 240, 300, 340, 385 };
+#else
+const uint16_t bAVal[8] PROGMEM = { 50, 95, 110, 170, 200, 295, 310, 390 };
+#endif
+
+// Analog inputs sampled by the ADC interrupt, in rotation order
+const uint8_t adcChannel[ADC_INPUTS] = { HOME_ANALOG_INPUT, AWAY_ANALOG_INPUT, TIMER_ANALOG_INPUT };
+
+// Indexes of the analog inputs in adcChannel and adcSample
+#define ADC_HOME                0
+#define ADC_AWAY                1
+#define ADC_TIMER               2
+
+// Buttons on every analog input, a bAVal range each
+#define LADDER_BUTTONS          4
+#define LADDER_NONE             0xFF
+
+// Button action handlers, see buttonAction
+#define ACT_NONE                0
+#define ACT_SCORE_ADD           1             // Basketball score + argument
+#define ACT_SCORE_SUB           2             // Basketball score - 1
+#define ACT_VSCORE_ADD          3             // Sets sports score + 1
+#define ACT_VSCORE_SUB          4
+#define ACT_SET_ADD             5             // Sets won + 1
+#define ACT_SET_SUB             6
+#define ACT_MINUTE_ADD          7             // Setup mode clock
+#define ACT_SECOND_ADD          8             // + argument
+#define ACT_SECOND_SUB          9
+#define ACT_START_STOP          10
+#define ACT_SHOT_RESET          11
+#define ACT_CLOCK_RESET         12
+#define ACT_SCORE_RESET         13
+#define ACT_VSCORE_RESET        14
+#define ACT_PERIOD_NEXT         15
+#define ACT_SET_NEXT            16
+#define ACT_RELOAD              17            // Score and clock from the EEPROM journal
+#define ACT_SETUP_ENTER         18
+#define ACT_SETUP_EXIT          19
+#define ACT_PRINT_EEPROM        20
+#define ACT_PRINT_PROFILE       21
+#define ACT_HORN                22
+#define ACT_NEXT_SPORT          23            // Next sport mode, exits the setup mode
+#define ACT_BRIGHTNESS          24            // Next brightness level
+
+// Action table entry: handler and a 3 bit argument
+#define ACTION(handler, arg)    ((handler) << 3 | (arg))
+#define ACTION_HANDLER(action)  ((action) >> 3)
+#define ACTION_ARG(action)      ((action) & 0x07)
+
+#define A_NONE                  ACTION(ACT_NONE, 0)
+
+// Action of every button (HOME_P1 ... SETUP_MODE), pressed and held, for the
+// sports played on time and on sets, out of and in setup mode
+const uint8_t buttonActions[4][SETUP_MODE - HOME_P1 + 1][2] PROGMEM = {
+  // Time
+  { { ACTION(ACT_SCORE_ADD, 1), ACTION(ACT_SCORE_ADD, 1) },           // HOME_P1
+    { ACTION(ACT_SCORE_ADD, 2), ACTION(ACT_SCORE_ADD, 2) },           // HOME_P2
+    { ACTION(ACT_SCORE_ADD, 3), ACTION(ACT_SCORE_ADD, 3) },           // HOME_P3
+    { ACTION(ACT_SCORE_SUB, 0), ACTION(ACT_SCORE_SUB, 0) },           // HOME_M1
+    { ACTION(ACT_SCORE_ADD, 1), ACTION(ACT_SCORE_ADD, 1) },           // AWAY_P1
+    { ACTION(ACT_SCORE_ADD, 2), ACTION(ACT_SCORE_ADD, 2) },           // AWAY_P2
+    { ACTION(ACT_SCORE_ADD, 3), ACTION(ACT_SCORE_ADD, 3) },           // AWAY_P3
+    { ACTION(ACT_SCORE_SUB, 0), ACTION(ACT_SCORE_SUB, 0) },           // AWAY_M1
+    { ACTION(ACT_START_STOP, 0), ACTION(ACT_START_STOP, 0) },         // TIMER_START_STOP
+    { ACTION(ACT_SHOT_RESET, 0), ACTION(ACT_CLOCK_RESET, 0) },        // TIMER_RESET
+    { ACTION(ACT_PERIOD_NEXT, 0), ACTION(ACT_PERIOD_NEXT, 0) },       // PERIOD_P1
+    { A_NONE, ACTION(ACT_SETUP_ENTER, 0) } },                         // SETUP_MODE
+  // Sets
+  { { ACTION(ACT_VSCORE_ADD, 0), ACTION(ACT_VSCORE_ADD, 0) },
+    { ACTION(ACT_VSCORE_SUB, 0), ACTION(ACT_VSCORE_SUB, 0) },
+    { ACTION(ACT_SET_ADD, 0), ACTION(ACT_SET_ADD, 0) },
+    { ACTION(ACT_SET_SUB, 0), ACTION(ACT_SET_SUB, 0) },
+    { ACTION(ACT_VSCORE_ADD, 0), ACTION(ACT_VSCORE_ADD, 0) },
+    { ACTION(ACT_VSCORE_SUB, 0), ACTION(ACT_VSCORE_SUB, 0) },
+    { ACTION(ACT_SET_ADD, 0), ACTION(ACT_SET_ADD, 0) },
+    { ACTION(ACT_SET_SUB, 0), ACTION(ACT_SET_SUB, 0) },
+    { A_NONE, A_NONE },
+    { A_NONE, ACTION(ACT_VSCORE_RESET, 0) },
+    { ACTION(ACT_SET_NEXT, 0), ACTION(ACT_SET_NEXT, 0) },
+    { A_NONE, ACTION(ACT_SETUP_ENTER, 0) } },
+  // Setup time
+  { { ACTION(ACT_PRINT_EEPROM, 0), ACTION(ACT_PRINT_EEPROM, 0) },
+    { ACTION(ACT_PRINT_PROFILE, 0), ACTION(ACT_PRINT_PROFILE, 0) },
+    { ACTION(ACT_HORN, 0), ACTION(ACT_HORN, 0) },
+    { ACTION(ACT_NEXT_SPORT, 0), ACTION(ACT_NEXT_SPORT, 0) },
+    { ACTION(ACT_MINUTE_ADD, 0), ACTION(ACT_MINUTE_ADD, 0) },
+    { ACTION(ACT_SECOND_ADD, 1), ACTION(ACT_SECOND_ADD, 1) },
+    { ACTION(ACT_SECOND_SUB, 0), ACTION(ACT_SECOND_SUB, 0) },
+    { ACTION(ACT_SECOND_ADD, 5), ACTION(ACT_SECOND_ADD, 5) },
+    { ACTION(ACT_BRIGHTNESS, 0), ACTION(ACT_BRIGHTNESS, 0) },
+    { ACTION(ACT_SCORE_RESET, 0), ACTION(ACT_SCORE_RESET, 0) },
+    { ACTION(ACT_RELOAD, 0), ACTION(ACT_RELOAD, 0) },
+    { ACTION(ACT_SETUP_EXIT, 0), ACTION(ACT_SETUP_ENTER, 0) } },
+  // Setup sets
+  { { ACTION(ACT_PRINT_EEPROM, 0), ACTION(ACT_PRINT_EEPROM, 0) },
+    { ACTION(ACT_PRINT_PROFILE, 0), ACTION(ACT_PRINT_PROFILE, 0) },
+    { ACTION(ACT_HORN, 0), ACTION(ACT_HORN, 0) },
+    { ACTION(ACT_NEXT_SPORT, 0), ACTION(ACT_NEXT_SPORT, 0) },
+    { A_NONE, A_NONE },
+    { A_NONE, A_NONE },
+    { A_NONE, A_NONE },
+    { A_NONE, A_NONE },
+    { ACTION(ACT_BRIGHTNESS, 0), ACTION(ACT_BRIGHTNESS, 0) },
+    { A_NONE, A_NONE },
+    { A_NONE, A_NONE },
+    { ACTION(ACT_SETUP_EXIT, 0), ACTION(ACT_SETUP_ENTER, 0) } } };
+
+// 7-segment font: segments a-g of the canonical font, wired to the panel bits
+// by the PANEL_* macros at compile time
+#define SEG_A                   0x01
+#define SEG_B                   0x02
+#define SEG_C                   0x04
+#define SEG_D                   0x08
+#define SEG_E                   0x10
+#define SEG_F                   0x20
+#define SEG_G                   0x40
+
+// Digits 1 and 4, the glyphs with the extra bit of the 7" display
+#define GLYPH_1                 (SEG_B | SEG_C)
+#define GLYPH_4                 (SEG_B | SEG_C | SEG_F | SEG_G)
+
+// Prototype breadboard display: segments a-g on bits 0-6, decimal point on bit 7
+#define PANEL_STD(s)            (s)
+#define PANEL_STD_DOT           0x80
+
+// Big 7" display: segments a-g on bits 0-6. Bit 7 is set for the digits 1 and 4
+// only, as in the digit table of the display (its wiring is not documented), and
+// never for the letters. No decimal point.
+#define PANEL_7_EXTRA           0x80
+#define PANEL_7(s)              ((s) | ((s) == GLYPH_1 || (s) == GLYPH_4 ? PANEL_7_EXTRA : 0))
+#define PANEL_7_DOT             0
+
+// 4" display: segments a-g on bits 1-7, decimal point on bit 0
+#define PANEL_4(s)              ((s) << 1)
+#define PANEL_4_DOT             0x01
+
+// Characters from ' ' to '_' (lowercase letters use the uppercase entries), blank
+// when they have no glyph
+#define FONT_FIRST              ' '
+#define FONT_SIZE               64
+
+#define FONT(P) { \
+  /*  ' ' ! " # $ % & '  */ \
+  P(0), P(0), P(SEG_B | SEG_F), P(0), P(0), P(0), P(0), P(SEG_B), \
+  /*  ( ) * + , - . /  */ \
+  P(SEG_A | SEG_D | SEG_E | SEG_F), P(SEG_A | SEG_B | SEG_C | SEG_D), P(0), P(0), P(0), P(SEG_G), \
+  P(0), P(0), \
+  /*  0 1 2 3  */ \
+  P(SEG_A | SEG_B | SEG_C | SEG_D | SEG_E | SEG_F), P(GLYPH_1), \
+  P(SEG_A | SEG_B | SEG_D | SEG_E | SEG_G), P(SEG_A | SEG_B | SEG_C | SEG_D | SEG_G), \
+  /*  4 5 6 7  */ \
+  P(GLYPH_4), P(SEG_A | SEG_C | SEG_D | SEG_F | SEG_G), \
+  P(SEG_A | SEG_C | SEG_D | SEG_E | SEG_F | SEG_G), P(SEG_A | SEG_B | SEG_C), \
+  /*  8 9 : ; < = > ?  */ \
+  P(SEG_A | SEG_B | SEG_C | SEG_D | SEG_E | SEG_F | SEG_G), P(SEG_A | SEG_B | SEG_C | SEG_D | SEG_F | SEG_G), \
+  P(0), P(0), P(0), P(SEG_D | SEG_G), P(0), P(SEG_A | SEG_B | SEG_E | SEG_G), \
+  /*  @ A b C d  */ \
+  P(0), P(SEG_A | SEG_B | SEG_C | SEG_E | SEG_F | SEG_G), P(SEG_C | SEG_D | SEG_E | SEG_F | SEG_G), \
+  P(SEG_A | SEG_D | SEG_E | SEG_F), P(SEG_B | SEG_C | SEG_D | SEG_E | SEG_G), \
+  /*  E F G H  */ \
+  P(SEG_A | SEG_D | SEG_E | SEG_F | SEG_G), P(SEG_A | SEG_E | SEG_F | SEG_G), \
+  P(SEG_A | SEG_C | SEG_D | SEG_E | SEG_F), P(SEG_B | SEG_C | SEG_E | SEG_F | SEG_G), \
+  /*  I J K L M n O  */ \
+  P(SEG_E | SEG_F), P(SEG_B | SEG_C | SEG_D | SEG_E), P(0), P(SEG_D | SEG_E | SEG_F), \
+  P(SEG_A | SEG_B | SEG_C | SEG_E | SEG_F), P(SEG_C | SEG_E | SEG_G), \
+  P(SEG_A | SEG_B | SEG_C | SEG_D | SEG_E | SEG_F), \
+  /*  P q r S t  */ \
+  P(SEG_A | SEG_B | SEG_E | SEG_F | SEG_G), P(SEG_A | SEG_B | SEG_C | SEG_F | SEG_G), P(SEG_E | SEG_G), \
+  P(SEG_A | SEG_C | SEG_D | SEG_F | SEG_G), P(SEG_D | SEG_E | SEG_F | SEG_G), \
+  /*  U V W X y Z  */ \
+  P(SEG_B | SEG_C | SEG_D | SEG_E | SEG_F), P(0), P(0), P(0), P(SEG_B | SEG_C | SEG_D | SEG_F | SEG_G), \
+  P(SEG_A | SEG_B | SEG_D | SEG_E | SEG_G), \
+  /*  [ \ ] ^ _  */ \
+  P(SEG_A | SEG_D | SEG_E | SEG_F), P(0), P(SEG_A | SEG_B | SEG_C | SEG_D), P(0), P(SEG_D) }
+
+#ifdef PROTOTYPE
+const byte fontStd[FONT_SIZE] PROGMEM = FONT(PANEL_STD);
 #else
-const uint16_t bAVal[10] = { 50, 95, 110, 170, 200, 295, 310, 390 };
-#endif
-
-// 7-Segments code for big 7" display
-const byte gDigits7[10] = { 1 + 2 + 4 + 8 + 16 + 32,
-                            2 + 4 + 128,
-                            1 + 2 + 8 + 16 + 64,
-                            1 + 2 + 4 + 8 + 64,
-                            2 + 4 + 32 + 64 + 128,
-                            1 + 4 + 8 + 32 + 64,
-                            1 + 4 + 8 + 16 + 32+ 64,
-                            1 + 2 + 4,
-                            1 + 2 + 4 + 8 + 16 + 32 + 64,
-                            1 + 2 + 4 + 8 + 32 + 64 };
-
-// 7-Segments code for 4" display
-const byte gDigits4[10] = { 2 + 4 + 8 + 16 + 32 + 64,
-                            4 + 8,
-                            2 + 4 + 16 + 32 + 128,
-                            2 + 4 + 8 + 16 + 128,
-                            4 + 8 + 64 + 128,
-                            2 + 8 + 16 + 64 + 128,
-                            2 + 8 + 16 + 32 + 64 + 128,
-                            2 + 4 + 8,
-                            2 + 4 + 8 + 16 + 32 + 64 + 128,
-                            2 + 4 + 8 + 16 + 64 + 128 };
+const byte font7[FONT_SIZE] PROGMEM = FONT(PANEL_7);
+const byte font4[FONT_SIZE] PROGMEM = FONT(PANEL_4);
+#endif
+
+// PWM duty cycle of the brightness steps: 255 * (step / 31) ^ 2.2, for a
+// perceived brightness proportional to the step
+const uint8_t brightnessGamma[BRIGHTNESS_STEPS] PROGMEM = {
+  0, 0, 1, 1, 3, 5, 7, 10, 13, 17, 21, 26, 32, 38, 44, 52,
+  60, 68, 77, 87, 97, 108, 120, 132, 145, 159, 173, 188, 204, 220, 237, 255 };
+
+// Horn on time (ms) at the end of every countdown channel
+const uint16_t hornOnTime[CD_CHANNELS] PROGMEM = {
+  BUZZER_ON_TIME, BUZZER_SHOT_TIME, BUZZER_TIMEOUT_TIME, BUZZER_INTERVAL_TIME };
 
 // ####################### Data types #######################
+// Scores shown on the display: packed BCD (the EEPROM and the serial interfaces
+// use the binary values)
 struct Score {
   uint16_t home;
   uint16_t away;
@@ -172,24 +621,94 @@ struct Time {
   uint16_t period;
 };
 
+// Countdown channel: "sec" seconds plus "tenth" tenths of second left. "clock" is
+// the time shown in packed BCD minutes and seconds (0xMMSS): the time left rounded
+// up (a clock just started shows its full time until a whole second elapsed), or
+// the elapsed one rounded down when "countUp" is set.
+struct Countdown {
+  uint16_t sec;
+  uint8_t tenth;
+  uint16_t clock;
+  boolean countUp;
+  boolean running;
+  boolean expired;      // Zero reached, horn pending
+  uint8_t link;         // Channel stopping this one, CD_NONE if independent
+};
+
+// Clock groups contents (packed BCD): minutes and seconds, or seconds and tenths
+struct ClockDigits {
+  uint16_t left;
+  uint16_t right;
+};
+
+// Single digits: the same in binary and packed BCD
 struct Sets {
   uint16_t actSet;
   uint16_t homeSet;
   uint16_t awaySet;
 };
 
-// Persistent data type to be written on the EEPROM
+// Buttons on an analog input (a resistor ladder): ids from "firstId" on, in the
+// bAVal ranges order. The buttons in "heldMask" (bit per ladder index) have a
+// held action: their short action fires on release.
+struct ButtonLadder {
+  uint8_t firstId;
+  uint8_t heldMask;
+  void (*handler)(int id, boolean held);
+  uint8_t candidate;            // Button read, LADDER_NONE if released
+  uint8_t pressed;              // Debounced button
+  boolean heldFired;
+  unsigned long changeTime;     // Candidate change
+  unsigned long pressTime;      // Debounced press
+};
+
+// Game values seen by the event log, binary, indexed by type and team (the
+// LOG_FIELD of the events)
+struct GameState {
+  int16_t value[LOG_FIELDS];
+  boolean running;              // Game clock running: its changes are no events
+};
+
+// Display group: "digits" digits showing the packed BCD "value" with "font" (in
+// PROGMEM). A NULL value leaves the digits blank.
+struct LayoutGroup {
+  uint16_t *value;
+  const byte *font;
+  uint8_t digits;
+};
+
+#define LAYOUT_GROUPS(layout)   (sizeof(layout) / sizeof(LayoutGroup))
+
+// Rules and display layout of a sport
+struct SportMode {
+  char key;                   // Remote control mode command letter
+  const LayoutGroup *layout;  // Display layout in chain order, in PROGMEM
+  uint8_t layoutGroups;
+  uint8_t periods;            // Periods (or sets) before wrapping to the first one
+  uint8_t setsToWin;          // 0 for the sports played on time
+  uint16_t periodLength;      // Seconds
+  uint8_t maxMinutes;         // Clock limit in setup mode
+  uint8_t halftimeAfter;      // Period followed by the halftime interval, 0 if none
+  boolean countUp;            // The clock shows the elapsed time
+};
+
+// Persistent data type to be written on the EEPROM: one record of the journal.
+// "counter" is the record sequence number, "crc" the CRC-CCITT of the other fields.
+// "time" is the clock shown: the elapsed time for a sport counting up.
 struct persistentData {
   uint32_t counter;
   Score score;
   Time time;
+  uint8_t mode;                 // Sport mode, index in sportModes
+  uint8_t vScore[2];            // Sets sports, binary: points home and away,
+  uint8_t vSets[3];             // actual set, sets won home and away
+  uint16_t crc;
 };
 
 // ####################### Variables #######################
 Score bScore;
 Time time;
 
-boolean timerRunning = false;
 volatile boolean updateDisplay = true;
 volatile boolean saveEEprom = false;
 boolean setupMode = false;
@@ -198,646 +717,3350 @@ boolean buzzerFired = false;
 boolean buzzerManCmd = false;
 unsigned long upDisplayTime = 0;
 unsigned long buzzerOnTime = 0;
-volatile unsigned long sec = 0;
-
-// Volleyball mode
-boolean volleyMode = false;
+unsigned long buzzerLength = 0;
+
+// Operator brightness level, gamma table step shown and fade target (the
+// Timer2 overflow interrupt steps toward it), idle dimming
+uint8_t brightnessLevel = BRIGHTNESS_LEVELS;
+volatile uint8_t brightnessStep = BRIGHTNESS_STEPS - 1;
+volatile uint8_t brightnessTarget = BRIGHTNESS_STEPS - 1;
+boolean brightnessDimmed = false;
+unsigned long activityTime = 0;
+volatile Countdown countdown[CD_CHANNELS] = {
+  { 0, 0, 0, false, false, false, CD_NONE },
+  { SHOT_CLOCK, 0, 0x0024, false, false, false, CD_GAME },
+  { 0, 0, 0, false, false, false, CD_NONE },
+  { 0, 0, 0, false, false, false, CD_NONE } };
+ClockDigits clockDigits;
+
+// Shot clock group contents: packed BCD seconds
+uint16_t shotDigits;
+
+// Latest analog input values, written by the ADC interrupt
+volatile uint16_t adcSample[ADC_INPUTS];
+
+// Inputs connected and no button pressed or being debounced (set by the loop):
+// the ADC interrupt raises EVENT_INPUT only when an input leaves the released level
+volatile boolean inputIdle = false;
+
+// Events not yet seen by the loop
+volatile uint8_t events = 0;
+
+// Volleyball and table tennis
 Score vScore;
 Sets vSets;
 
+// Display layouts: sports played on time (clock, period and score, the shot
+// clock at the end of the chain for basketball) and on sets (score, sets won and
+// actual set)
+#ifdef PROTOTYPE
+const LayoutGroup layoutTime[] PROGMEM = {
+  { &clockDigits.left, fontStd, 2 },
+  { &clockDigits.right, fontStd, 2 },
+  { &time.period, fontStd, 1 },
+  { &bScore.home, fontStd, 2 },
+  { &bScore.away, fontStd, 2 } };
+
+const LayoutGroup layoutBasketball[] PROGMEM = {
+  { &clockDigits.left, fontStd, 2 },
+  { &clockDigits.right, fontStd, 2 },
+  { &time.period, fontStd, 1 },
+  { &bScore.home, fontStd, 2 },
+  { &bScore.away, fontStd, 2 },
+  { &shotDigits, fontStd, 2 } };
+
+const LayoutGroup layoutSets[] PROGMEM = {
+  { NULL, fontStd, 1 },
+  { &vSets.homeSet, fontStd, 1 },
+  { &vSets.awaySet, fontStd, 1 },
+  { NULL, fontStd, 1 },
+  { &vSets.actSet, fontStd, 1 },
+  { &vScore.home, fontStd, 2 },
+  { &vScore.away, fontStd, 2 } };
+#else
+const LayoutGroup layoutTime[] PROGMEM = {
+  { &bScore.home, font7, 2 },
+  { &bScore.away, font7, 2 },
+  { &time.period, font7, 1 },
+  { &clockDigits.left, font4, 2 },
+  { &clockDigits.right, font4, 2 } };
+
+const LayoutGroup layoutBasketball[] PROGMEM = {
+  { &bScore.home, font7, 2 },
+  { &bScore.away, font7, 2 },
+  { &time.period, font7, 1 },
+  { &clockDigits.left, font4, 2 },
+  { &clockDigits.right, font4, 2 },
+  { &shotDigits, font4, 2 } };
+
+const LayoutGroup layoutSets[] PROGMEM = {
+  { &vScore.home, font7, 2 },
+  { &vScore.away, font7, 2 },
+  { &vSets.actSet, font7, 1 },
+  { NULL, font7, 1 },
+  { &vSets.homeSet, font4, 1 },
+  { &vSets.awaySet, font4, 1 },
+  { NULL, font4, 1 } };
+#endif
+
+#ifdef DISPLAY_PARALLEL
+#ifdef PROTOTYPE
+#define PANEL_FONT              fontStd
+#else
+#define PANEL_FONT              font4
+#endif
+
+// Time panel: clock and period, or sets won and actual set
+const LayoutGroup layoutPanelTime[] PROGMEM = {
+  { &clockDigits.left, PANEL_FONT, 2 },
+  { &clockDigits.right, PANEL_FONT, 2 },
+  { &time.period, PANEL_FONT, 1 } };
+
+const LayoutGroup layoutPanelSets[] PROGMEM = {
+  { &vSets.homeSet, PANEL_FONT, 1 },
+  { &vSets.actSet, PANEL_FONT, 1 },
+  { &vSets.awaySet, PANEL_FONT, 1 } };
+#endif
 
-// EEPROM wear leveling algorithm variables
+// Sport modes registry in PROGMEM: switching mode copies one in "sport"
+const SportMode sportModes[SPORT_MODES] PROGMEM = {
+  // Basketball: 4 quarters and 2 overtimes
+  { 'B', layoutBasketball, LAYOUT_GROUPS(layoutBasketball), 6, 0,
+    TIMER_INIT_MIN * 60 + TIMER_INIT_SEC, MAX_MINUTES, 2, false },
+  // Volleyball: best of 5 sets
+  { 'V', layoutSets, LAYOUT_GROUPS(layoutSets), 5, 3, 0, 0, 0, false },
+  // Handball: 2 halves of 30 minutes
+  { 'H', layoutTime, LAYOUT_GROUPS(layoutTime), 2, 0, 30 * 60, 30, 1, true },
+  // Futsal: 2 halves of 20 minutes
+  { 'F', layoutTime, LAYOUT_GROUPS(layoutTime), 2, 0, 20 * 60, 20, 1, true },
+  // Table tennis: best of 7 games
+  { 'T', layoutSets, LAYOUT_GROUPS(layoutSets), 7, 4, 0, 0, 0, false } };
+
+// Sport mode played, and its index in sportModes
+SportMode sport;
+uint8_t sportIndex = SPORT_BASKETBALL;
+
+
+// EEPROM journal variables: the whole EEPROM is a ring buffer of records,
+// every write goes to the record after the last one.
 // Buffer for store values from EEPROM on first read upon startup
 persistentData dataEE;
 
-// Counts up the erase-write cycle in the current cell pointed to by offsetEE
+// Sequence number of the newest record: the journal has been written over
+// counterEE / EEPROM_RECORDS times
 uint32_t counterEE;
 
-// Points to the location in EEPROM where it is possible to save data (still
-// no end of life cell i.e. counteEE < EEPROM_MAX_WRITE)
+// Points to the location in EEPROM of the newest record
 uint16_t offsetEE;
 
 // Signal end of EEPROM life
 boolean endOfLifeEE = false;
 
-// #########################################################
-// ############### 7-segment display library ###############
+#ifdef POWER_SENSE
+// Supply failing, latched by the comparator interrupt until the loop sees it
+// good again: the display outputs are not enabled meanwhile
+volatile boolean powerDown = false;
 
-// Different output enable state for different type of shift register
-#ifdef PROTOTYPE
-DisplayGroup::DisplayManager disManager(PIN_COM_DATA, PIN_COM_CLOCK, PIN_OUTPUT_ENABLE, LOW);
-#else
-DisplayGroup::DisplayManager disManager(PIN_COM_DATA, PIN_COM_CLOCK, PIN_OUTPUT_ENABLE, HIGH);
+// Last record written for a power fail, waiting for the supply to come back
+boolean powerFail = false;
 #endif
 
-// #########################################################
-
-
-// #########################################################
-// Configuration of digital buttons on the analog interface
+// Message shown instead of the values from the group "messageGroup" on, for
+// "messageDuration" ms (0: no message)
+char messageText[DISPLAY_MAX_DIGITS + 1];
+uint8_t messageGroup;
+unsigned long messageTime;
+uint16_t messageDuration = 0;
+
+#if defined(PROFILER) || defined(SIMULATOR)
+// Loop phases measured by the profiler, or by the simulator benchmark
+enum ProfilePhase {
+  PROFILE_SNAPSHOT,     // Interrupt free copy of the shared variables
+  PROFILE_BUZZER,
+  PROFILE_DISPLAY,      // updateAll
+  PROFILE_EEPROM,       // writeEEPROM
+  PROFILE_INPUT,        // Analog inputs connection check and button ladders
+  PROFILE_LOOP,         // Whole loop pass
+  PROFILE_TICK,         // Latency from the timer interrupt to the loop
+  PROFILE_SLEEP,        // Idle sleep waiting for an event
+  PROFILE_PHASES
+};
+#endif
 
-AnalogButtons homeButtons(DEBOUNCING_COUNT_HOME, &handleHomeButtons);
-Button b1 = Button(HOME_P1, bAVal[0], bAVal[1]);
-Button b2 = Button(HOME_P2, bAVal[2], bAVal[3]);
-Button b3 = Button(HOME_P3, bAVal[4], bAVal[5]);
-Button b4 = Button(HOME_M1, bAVal[6], bAVal[7]);
+#ifdef PROFILER
+const char * const profileName[PROFILE_PHASES] = { "snapshot", "buzzer", "display", "eeprom",
+                                                   "input", "loop", "tick latency", "sleep" };
 
-AnalogButtons awayButtons(DEBOUNCING_COUNT, &handleAwayButtons);
-Button b5 = Button(AWAY_P1, bAVal[0], bAVal[1]);
-Button b6 = Button(AWAY_P2, bAVal[2], bAVal[3]);
-Button b7 = Button(AWAY_P3, bAVal[4], bAVal[5]);
-Button b8 = Button(AWAY_M1, bAVal[6], bAVal[7]);
+// Statistics of one phase, in us
+struct ProfileStat {
+  uint16_t min;
+  uint16_t max;
+  uint32_t total;
+  uint32_t count;
+  uint16_t histogram[PROFILE_BUCKETS];
+};
 
-AnalogButtons timerButtons(DEBOUNCING_COUNT, &handleTimerButtons);
-Button b9 = Button(TIMER_START_STOP, bAVal[0], bAVal[1]);
-Button b10 = Button(TIMER_RESET, bAVal[2], bAVal[3], HELD_DURATION);
-Button b11 = Button(PERIOD_P1, bAVal[4], bAVal[5]);
-Button b12 = Button(SETUP_MODE, bAVal[6], bAVal[7], HELD_DURATION);
+ProfileStat profile[PROFILE_PHASES];
 
-// #########################################################
+// Start of the phase and of the loop pass being measured
+unsigned long profileStart;
+unsigned long profileLoopStart;
 
-void configureAnalogB() {
-  AnalogButtons::configure(HOME_ANALOG_INPUT);
-  AnalogButtons::configure(AWAY_ANALOG_INPUT);
-  AnalogButtons::configure(TIMER_ANALOG_INPUT);
-  Serial.println("-------");
-  delay(200);
-}
+// Start of the statistics, for the sleep duty cycle
+unsigned long profileResetTime;
 
-void handleHomeButtons(int id, boolean held) {
+// Time of the last timer interrupt not yet seen by the loop
+volatile unsigned long profileTickTime;
+volatile boolean profileTick = false;
 
-#ifdef DEBUG
-  Serial.print("HOME = ");
-  Serial.print(id);
-  Serial.print(",  HELD = ");
-  Serial.println(held);
+#define PROFILE_START()         profileStart = halMicros();
+#define PROFILE_END(phase)      profileAdd(phase, halMicros() - profileStart);
+#define PROFILE_START_LOOP()    profileLoopStart = halMicros();
+#define PROFILE_END_LOOP()      profileAdd(PROFILE_LOOP, halMicros() - profileLoopStart);
+#elif defined(SIMULATOR)
+#define PROFILE_START()         halMark(SIM_MARK_START);
+#define PROFILE_END(phase)      halMark(phase);
+#define PROFILE_START_LOOP()    halMark(SIM_MARK_LOOP);
+#define PROFILE_END_LOOP()      halMark(PROFILE_LOOP);
+#else
+#define PROFILE_START()
+#define PROFILE_END(phase)
+#define PROFILE_START_LOOP()
+#define PROFILE_END_LOOP()
 #endif
 
-  updateDisplay = true;
-
-  switch (id) {
+// Background EEPROM writer: record being written and copy of the record
+// in EEPROM at offsetEE, compared byte by byte by the EEPROM ready interrupt.
+// Requests arriving while a record is being written are queued in "nextEE",
+// the newest values only.
+persistentData targetEE;
+persistentData committedEE;
+persistentData nextEE;
 
-    case HOME_P1:
-      if (setupMode) {
-        printEEPROM();
-        return;
-      }
+// Next byte to compare, true until the record has been written, and true while
+// a record is queued
+volatile uint8_t indexEE = 0;
+volatile boolean pendingEE = false;
+volatile boolean queuedEE = false;
 
-      if (volleyMode) {
-        vScore.home++;
-        return;
-      }
+// #########################################################
+// ############## Hardware abstraction layer ###############
+// #########################################################
 
-      // Increment home score
-      bScore.home++;
-      saveEEprom = true;
-      return;
+// The ATmega328P peripherals (Timer1, ADC, SPI, EEPROM), the pins, the time and
+// the serial interface of the Arduino core are accessed only through these
+// functions, and every ISR only calls its handler: together with the interrupt
+// free sections (SREG, cli, sei) and the PROGMEM reads, this is the whole
+// interface between the program and the hardware. The HOST build replaces it
+// with the simulated board of Host/host.cpp (see Host/host.h).
 
-    case HOME_P2:
-      if (setupMode) {
-        return;
-      }
+#ifndef HOST
+void halPinOutput(uint8_t pin) {
+  pinMode(pin, OUTPUT);
+}
 
-      if (volleyMode) {
-        if (vScore.home > 0) {
-          vScore.home--;
-        }
-        return;
-      }
+void halPinWrite(uint8_t pin, uint8_t level) {
+  digitalWrite(pin, level);
+}
 
-      bScore.home += 2;
-      saveEEprom = true;
-      return;
+// One byte on a data and clock pin pair, MSB first
+void halShiftOut(uint8_t dataPin, uint8_t clockPin, uint8_t value) {
+  shiftOut(dataPin, clockPin, MSBFIRST, value);
+}
 
-    case HOME_P3:
-      if (setupMode) {
-        buzzerManCmd = true;
-        return;
-      }
+// Time since reset, counted by the Timer0 overflow interrupt of the core
+unsigned long halMillis() {
+  return millis();
+}
 
-      if (volleyMode) {
-        if (vSets.homeSet < 3 && vSets.awaySet < 3) {
-          vSets.homeSet++;
-        }
-        return;
-      }
+unsigned long halMicros() {
+  return micros();
+}
 
-      bScore.home += 3;
-      saveEEprom = true;
-      return;
+// Serial interface: RX and TX buffers filled and emptied by the interrupts of the core
+void halSerialBegin(unsigned long baud) {
+  Serial.begin(baud);
+}
 
-    case HOME_M1:
-      if (setupMode) {
+// Next received byte, -1 if none
+int halSerialRead() {
+  return Serial.read();
+}
 
-        volleyMode = !volleyMode;
+int halSerialAvailable() {
+  return Serial.available();
+}
 
-        if (volleyMode) {
-		  // Volleyball mode
-          disManager.clearGroups();
+// Bytes that fit in the TX buffer without waiting
+int halSerialRoom() {
+  return Serial.availableForWrite();
+}
 
-#ifdef PROTOTYPE
-          disManager.addGroup(0, 1, NULL);
-          disManager.addGroup(1, 1, &vSets.homeSet);
-          disManager.addGroup(2, 1, &vSets.awaySet);
-          disManager.addGroup(3, 1, NULL);
-          disManager.addGroup(4, 1, &vSets.actSet);
-          disManager.addGroup(5, 2, &vScore.home);
-          disManager.addGroup(6, 2, &vScore.away);
-
-          disManager.enableGroup(0, false);
-          disManager.enableGroup(3, false);
-#else
-          disManager.addGroup(0, 2, &vScore.home, gDigits7, sizeof(gDigits7));
-          disManager.addGroup(1, 2, &vScore.away, gDigits7, sizeof(gDigits7));
-          disManager.addGroup(2, 1, &vSets.actSet, gDigits7, sizeof(gDigits7));
-          disManager.addGroup(3, 1, NULL);
-          disManager.addGroup(4, 1, &vSets.homeSet, gDigits4, sizeof(gDigits4));
-          disManager.addGroup(5, 1, &vSets.awaySet, gDigits4, sizeof(gDigits4));
-          disManager.addGroup(6, 1, NULL);
-
-          disManager.enableGroup(3, false);
-          disManager.enableGroup(6, false);
-#endif
-        } else {
-          // Basketball mode
-		  disManager.clearGroups();
-          setupDiplay();
-        }
-        setupMode = false;
-        return;
-      }
+// Waits only for room in the TX buffer
+void halSerialWrite(const uint8_t *data, uint8_t size) {
+  Serial.write(data, size);
+}
 
-      if (volleyMode) {
-        if (vSets.homeSet > 0) {
-          vSets.homeSet--;
-        }
-        return;
-      }
+// Nothing left in the TX buffer, the last byte may still be shifting out
+boolean halSerialTxEmpty() {
+  return Serial.availableForWrite() == SERIAL_TX_BUFFER_SIZE - 1;
+}
 
-      // Decrement basketball home score
-      if (bScore.home > 0) {
-        bScore.home--;
-        saveEEprom = true;
-      }
-      return;
+// Transmit complete interrupt (the core uses the data register empty one only):
+// enable it after writing, the write clears the pending flag
+void halSerialTxInterrupt(boolean enable) {
+  if (enable) {
+    UCSR0B |= _BV(TXCIE0);
+  } else {
+    UCSR0B &= ~_BV(TXCIE0);
   }
 }
 
-void handleAwayButtons(int id, boolean held) {
-  unsigned char sreg;
-
-#ifdef DEBUG
-  Serial.print("AWAY = ");
-  Serial.print(id);
-  Serial.print(",  HELD = ");
-  Serial.println(held);
-#endif
+// Text and numbers, as the print functions of the core
+template<class T> inline void halPrint(T value) {
+  Serial.print(value);
+}
 
-  if (setupMode && volleyMode) {
-    return;
-  }
+template<class T> inline void halPrintln(T value) {
+  Serial.println(value);
+}
 
-  updateDisplay = true;
+inline void halPrintln() {
+  Serial.println();
+}
 
-  switch (id) {
-
-    case AWAY_P1:
-      // Increment away score or minute in setup mode
-      if (setupMode && !volleyMode) {
-        if (time.min == MAX_MINUTES) {
-          time.min = 0;
-        } else {
-		  time.min++;
-		}
-		sec = time.min * 60 + time.sec;
-		RESET_TIMER_COUNTER(sreg);
-        return;
-      }
+// Timer1 in CTC mode, compare A interrupt every "top" + 1 ticks, stopped
+void halTimer1Init(uint16_t top) {
+  unsigned char sreg;
 
-      if (volleyMode) {
-        vScore.away++;
-        return;
-      }
+  sreg = SREG;
+  cli();
+  TCCR1A = 0;
+  TCCR1B = 0;
+  OCR1A = top;
+  TIMSK1 |= _BV(OCIE1A);    // Enable timer compare interrupt
+  TCNT1 = 0;                // Reset counter
+  TIFR1 |= _BV(OCF1A);      // Clear interrupt flag
+  SREG = sreg;
+}
 
-      bScore.away++;
-      saveEEprom = true;
-      return;
+// Start (CTC mode, prescaler 256) or stop Timer1
+void halTimer1Run(boolean run) {
+  unsigned char sreg;
 
-    case AWAY_P2:
-      if (setupMode && !volleyMode) {
-        time.sec++;
-        if (time.sec > 59) {
-          time.sec = 0;
-        }
-	    sec = time.min * 60 + time.sec;
-	    RESET_TIMER_COUNTER(sreg);
-        return;
-      }
+  sreg = SREG;
+  cli();
+  TCCR1B = run ? _BV(WGM12) | _BV(CS12) : 0;
+  SREG = sreg;
+}
 
-      if (volleyMode) {
-        if (vScore.away > 0) {
-          vScore.away--;
-        }
-        return;
-      }
+// Timer1 period started again from now: the next compare match one period later
+void halTimer1Restart() {
+  unsigned char sreg;
 
-      bScore.away += 2;
-      saveEEprom = true;
-      return;
+  sreg = SREG;
+  cli();
+  TCNT1 = 0;
+  TIFR1 |= _BV(OCF1A);
+  SREG = sreg;
+}
 
-    case AWAY_P3:
-      if (setupMode && !volleyMode) {
-        if (time.sec == 0) {
-          time.sec = 59;
-        } else {
-		 time.sec--;
-		}
-		sec = time.min * 60 + time.sec;
-		RESET_TIMER_COUNTER(sreg);
-        return;
-      }
+// ADC on "channel" with AVcc reference and prescaler 128, a conversion started by
+// every Timer0 overflow, conversion complete interrupt enabled. "digitalInputs" disables the digital input buffers.
+void halAdcInit(uint8_t channel, uint8_t digitalInputs) {
+  unsigned char sreg;
 
-      if (volleyMode) {
-        if (vSets.awaySet < 3 && vSets.homeSet < 3) {
-          vSets.awaySet++;
-        }
-        return;
-      }
+  sreg = SREG;
+  cli();
+  DIDR0 = digitalInputs;
+  ADMUX = _BV(REFS0) | channel;
+  ADCSRB = _BV(ADTS2);      // Auto trigger on Timer0 overflow
+  ADCSRA = _BV(ADEN) | _BV(ADATE) | _BV(ADIE) | _BV(ADIF)
+      | _BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0);
+  SREG = sreg;
+}
 
-      bScore.away += 3;
-      saveEEprom = true;
-      return;
+// Input for the next conversion started
+void halAdcSelect(uint8_t channel) {
+  ADMUX = _BV(REFS0) | channel;
+}
 
-    case AWAY_M1:
-      if (setupMode && !volleyMode) {
-        time.sec += 5;
-        time.sec %= 60;
-		sec = time.min * 60 + time.sec;
-		RESET_TIMER_COUNTER(sreg);
-        return;
-      }
+// SPI master, MSB first, mode 0 (data sampled on the clock rising edge), interrupt enabled
+void halSpiInit() {
+  halPinOutput(PIN_SPI_SS);
+  halPinOutput(PIN_SPI_MOSI);
+  halPinOutput(PIN_SPI_SCK);
 
-      if (volleyMode) {
-        if (vSets.awaySet > 0) {
-          vSets.awaySet--;
-        }
-        return;
-      }
+  SPCR = _BV(SPE) | _BV(MSTR) | _BV(SPIE) | DISPLAY_SPI_CLOCK;
+  SPSR = 0;
+}
 
-      // Decrement basketball away score
-      if (bScore.away > 0) {
-        bScore.away--;
-        saveEEprom = true;
-      }
-      return;
-  }
+void halSpiWrite(byte value) {
+  SPDR = value;
 }
 
-void handleTimerButtons(int id, boolean held) {
-  unsigned char sreg;
+#ifdef DISPLAY_PARALLEL
+// Display chains on PORTD: "bits" on the data lines of "dataMask" with the clock
+// line "clockMask" low, then its rising edge. One store for all the chains.
+inline void halBusShift(uint8_t dataMask, uint8_t clockMask, uint8_t bits) {
+  uint8_t port = (PORTD & ~(dataMask | clockMask)) | bits;
 
-#ifdef DEBUG
-  Serial.print("TIMER = ");
-  Serial.print(id);
-  Serial.print(",  HELD = ");
-  Serial.println(held);
+  PORTD = port;
+  PORTD = port | clockMask;
+}
 #endif
 
-  updateDisplay = true;
-
-  switch (id) {
-
-    case TIMER_START_STOP:
-      if (setupMode or volleyMode) {
-        return;
-      }
+void halEepromRead(void *data, uint16_t offset, uint16_t size) {
+  eeprom_read_block(data, (const void*) offset, size);
+}
 
-      if (timerRunning) {
-        // Stop timer, save global interrupt flag and restore after
-        START_STOP_TIMER(sreg, 0);
-        timerRunning = false;
-      } else {
-        // Start/restart timer
-        if (time.min == 0 && time.sec == 0) {
-          return;
-        }
-        // Start timer
-        START_STOP_TIMER(sreg, 13);
-        timerRunning = true;
-      }
-      return;
+// Blocking write, only if the value is different
+void halEepromUpdate(uint16_t offset, uint8_t value) {
+  eeprom_update_byte((uint8_t*) offset, value);
+}
 
-    case TIMER_RESET:
-      if (setupMode) {
-        if (!volleyMode) {
-          // Reset score
-          bScore.home = 0;
-          bScore.away = 0;
-          return;
-        } else return;
-      }
+// Start the write of one byte: the EEPROM is not ready until the end of the write
+void halEepromWrite(uint16_t offset, uint8_t value) {
+  EEAR = offset;
+  EEDR = value;
+  EECR |= _BV(EEMPE);
+  EECR |= _BV(EEPE);
+}
 
-      if (volleyMode && held) {
-        vScore.home = 0;
-        vScore.away = 0;
-        return;
-      }
+boolean halEepromReady() {
+  return eeprom_is_ready();
+}
 
-      if (!timerRunning && held) {
-        RESET_TIMER_COUNTER(sreg);
+// EEPROM ready interrupt: fires as long as enabled and the EEPROM is ready
+void halEepromInterrupt(boolean enable) {
+  if (enable) {
+    EECR |= _BV(EERIE);
+  } else {
+    EECR &= ~_BV(EERIE);
+  }
+}
 
-        time.min = TIMER_INIT_MIN;
-        time.sec = TIMER_INIT_SEC;
-        sec = TIMER_INIT_MIN * 60 + TIMER_INIT_SEC;
-      }
-      return;
+// Timer2 fast PWM on OC2B (PIN_OUTPUT_ENABLE), prescaler 64 (~977 Hz), output
+// disconnected. "inverted" for an active low output: the duty cycle is the low time.
+uint8_t halPwmCompareMode;
 
-    case PERIOD_P1:
-      // If setup mode is active reload values from EEPROM internal memory (basketball score)
-      if (setupMode) {
-        if (!volleyMode) {
-          bScore = dataEE.score;
-          time = dataEE.time;
-          sec = time.min * 60 + time.sec;
-          return;
-        } else return;
-      }
+void halPwmInit(boolean inverted) {
+  unsigned char sreg;
 
-      if (volleyMode) {
-        if (vSets.actSet == 5) {
-          vSets.actSet = 1;
-        } else vSets.actSet++;
-        return;
-      }
+  sreg = SREG;
+  cli();
+  halPwmCompareMode = inverted ? _BV(COM2B1) | _BV(COM2B0) : _BV(COM2B1);
+  TCCR2A = _BV(WGM21) | _BV(WGM20);
+  TCCR2B = _BV(CS22);
+  OCR2B = 0;
+  TIMSK2 = 0;
+  SREG = sreg;
+}
 
-      if (time.period == 6) {
-        time.period = 1;
-      } else time.period++;
+// Duty cycle (0-255), updated by the timer at the end of the PWM cycle
+void halPwmDuty(uint8_t duty) {
+  OCR2B = duty;
+}
 
-      saveEEprom = true;
-      return;
+// Connect OC2B to the pin, or leave it to the pin output value
+void halPwmOutput(boolean connect) {
+  TCCR2A = _BV(WGM21) | _BV(WGM20) | (connect ? halPwmCompareMode : 0);
+}
 
-    case SETUP_MODE:
-      // If held activates "setup mode": change of current time and reload
-      // values from EEPROM memory
-      if (!timerRunning && held) {
-        setupMode = true;
-      } else if (!timerRunning && setupMode) {
-        setupMode = false;
-        saveEEprom = true;
-      }
-      return;
+// Overflow interrupt at the end of every PWM cycle
+void halPwmInterrupt(boolean enable) {
+  if (enable) {
+    TIFR2 = _BV(TOV2);
+    TIMSK2 = _BV(TOIE2);
+  } else {
+    TIMSK2 = 0;
   }
 }
 
-ISR(TIMER1_COMPA_vect) {
-  sec--;
-  updateDisplay = true;
+#ifdef POWER_SENSE
+// Analog comparator between the bandgap (positive input) and AIN1, interrupt on
+// the output rising edge: AIN1 falling below the bandgap
+void halPowerSenseInit() {
+  DIDR1 = _BV(AIN1D);
+  ACSR = _BV(ACBG) | _BV(ACI) | _BV(ACIE) | _BV(ACIS1) | _BV(ACIS0);
+}
+
+boolean halPowerGood() {
+  return !(ACSR & _BV(ACO));
+}
+#endif
+
+#ifdef SIMULATOR
+// Benchmark marker: a general purpose I/O register, one cycle and no effect on
+// the hardware, watched by the simulator
+inline void halMark(uint8_t value) {
+  GPIOR0 = value;
+}
+#endif
+
+// Idle sleep until the next interrupt (timers, ADC, serial, SPI and EEPROM keep
+// running): called with the interrupts disabled, returns with them enabled
+void halSleep() {
+  set_sleep_mode(SLEEP_MODE_IDLE);
+  sleep_enable();
+  sei();                    // The next instruction runs before any interrupt
+  sleep_cpu();
+  sleep_disable();
+}
+
+ISR(TIMER1_COMPA_vect) {
+  onTimerTick();
+}
+
+ISR(ADC_vect) {
+  onAdcComplete(ADC);
+}
+
+ISR(EE_READY_vect) {
+  onEepromReady();
+}
+
+#ifdef DISPLAY_SPI
+ISR(SPI_STC_vect) {
+  onSpiComplete();
+}
+#endif
+
+ISR(TIMER2_OVF_vect) {
+  onPwmOverflow();
+}
+
+#ifdef POWER_SENSE
+ISR(ANALOG_COMP_vect) {
+  onPowerFail();
+}
+#endif
+
+#ifdef LINK
+ISR(USART_TX_vect) {
+  onSerialTxComplete();
+}
+#endif
+#else
+// Interrupt vectors of the simulated board: the peripherals of Host/host.cpp
+// raise them, "value" is the ADC result
+void hostInterrupt(uint8_t vector, uint16_t value) {
+  switch (vector) {
+    case HOST_TIMER1_COMPA:
+      onTimerTick();
+      break;
+    case HOST_ADC:
+      onAdcComplete(value);
+      break;
+    case HOST_EE_READY:
+      onEepromReady();
+      break;
+#ifdef DISPLAY_SPI
+    case HOST_SPI_STC:
+      onSpiComplete();
+      break;
+#endif
+    case HOST_TIMER2_OVF:
+      onPwmOverflow();
+      break;
+#ifdef POWER_SENSE
+    case HOST_ANALOG_COMP:
+      onPowerFail();
+      break;
+#endif
+#ifdef LINK
+    case HOST_USART_TX:
+      onSerialTxComplete();
+      break;
+#endif
+  }
+}
+#endif
+
+// #########################################################
+// ###################### Packed BCD #######################
+// #########################################################
+
+// The displayed values are kept in packed BCD (one decimal digit per nibble), so
+// that the display never divides: the counters step with carry and borrow, the
+// conversions from binary happen only on the rare direct settings.
+
+uint16_t bcdIncrement(uint16_t value) {
+  for (uint8_t shift = 0; shift < 16; shift += 4) {
+    if (((value >> shift) & 0x0F) != 9) {
+      return value + (1 << shift);
+    }
+    // 9 to 0 and carry
+    value &= ~(0x0F << shift);
+  }
+  return value;
+}
+
+// "value" must be greater than 0
+uint16_t bcdDecrement(uint16_t value) {
+  for (uint8_t shift = 0; shift < 16; shift += 4) {
+    if (((value >> shift) & 0x0F) != 0) {
+      return value - (1 << shift);
+    }
+    // 0 to 9 and borrow
+    value |= 9 << shift;
+  }
+  return value;
+}
+
+// Minutes and seconds clock (0xMMSS): the seconds wrap at 60
+uint16_t bcdClockIncrement(uint16_t clock) {
+  clock = bcdIncrement(clock);
+  if ((clock & 0xFF) == 0x60) {
+    clock = bcdIncrement((clock & 0xFF00) | 0x99);
+  }
+  return clock;
+}
+
+uint16_t bcdClockDecrement(uint16_t clock) {
+  clock = bcdDecrement(clock);
+  if ((clock & 0xFF) == 0x99) {
+    clock -= 0x40;
+  }
+  return clock;
+}
+
+// Binary to packed BCD by subtraction, up to 9999
+uint16_t toBcd(uint16_t value) {
+  uint16_t bcd = 0;
+
+  while (value >= 1000) {
+    value -= 1000;
+    bcd += 0x1000;
+  }
+  while (value >= 100) {
+    value -= 100;
+    bcd += 0x100;
+  }
+  while (value >= 10) {
+    value -= 10;
+    bcd += 0x10;
+  }
+  return bcd + value;
+}
+
+uint16_t fromBcd(uint16_t bcd) {
+  uint16_t value = 0;
+
+  for (uint8_t d = 0; d < 4; d++) {
+    value = value * 10 + (bcd >> 12);
+    bcd <<= 4;
+  }
+  return value;
+}
+
+// Seconds to a minutes and seconds clock (0xMMSS)
+uint16_t toBcdClock(uint16_t seconds) {
+  uint8_t min = 0;
+
+  while (seconds >= 60) {
+    seconds -= 60;
+    min++;
+  }
+  return toBcd(min) << 8 | toBcd(seconds);
+}
+
+// #########################################################
+// ################ 7-segment display chain ################
+// #########################################################
+
+// Segments of the character "c" in "font"
+byte fontGlyph(const byte *font, char c) {
+  if (c >= 'a' && c <= 'z') {
+    c -= 'a' - 'A';
+  }
+
+  if (c < FONT_FIRST || c >= FONT_FIRST + FONT_SIZE) {
+    return 0;
+  }
+  return pgm_read_byte(&font[c - FONT_FIRST]);
+}
+
+// Decimal point bit of the panel "font" is made for, 0 if it has none
+byte fontDot(const byte *font) {
+#ifdef PROTOTYPE
+  return font == fontStd ? PANEL_STD_DOT : 0;
+#else
+  return font == font4 ? PANEL_4_DOT : PANEL_7_DOT;
+#endif
+}
+
+// The displays are connected in a single chain of shift registers, one for every
+// digit. Groups of digits show one value each, group 0 being the nearest to the
+// board: the frame is shifted out from the last digit of the last group, so that
+// every byte reaches its own register at the end of the frame. The shift register
+// outputs are disabled while shifting: the displays latch complete frames only.
+// Frames are encoded into a back buffer, the front one is the frame sent last.
+// In DISPLAY_PARALLEL build more chains, each with its own layout, are attached to
+// the main one: they are encoded and latched with it, and shifted out at the same
+// time on their data lines, one bit of every chain per clock edge.
+class DisplayChain {
+public:
+  DisplayChain(uint8_t dataPin, uint8_t clockPin, uint8_t enablePin, uint8_t enableLevel);
+
+  // Configure the output pins (and the SPI peripheral in DISPLAY_SPI build)
+  void begin();
+
+  // Append "chain" to the chains sent with this one (DISPLAY_PARALLEL build),
+  // before begin. Only its data pin is used.
+  void attach(DisplayChain *chain);
+
+  // Show the "count" groups of "layout" (in PROGMEM), in chain order. The layout
+  // is only referenced: switching layout copies nothing.
+  void setLayout(const LayoutGroup *layout, uint8_t count);
+
+  // Disabled groups keep their digits in the chain, but blank
+  void enableGroup(uint8_t index, boolean enable);
+
+  // Blank the digits of the group in "mask" (bit 0 the leftmost digit), whatever the value
+  void blankDigits(uint8_t index, uint8_t mask);
+
+  // Light the decimal point of the digits of the group in "mask" (bit 0 the
+  // leftmost digit), on the panels having one
+  void dotDigits(uint8_t index, uint8_t mask);
+
+  // Show "text" on the digits of the groups from "index" on, instead of their
+  // values; NULL shows the values again. The text is only referenced.
+  void showText(uint8_t index, const char *text);
+
+  // Encode the groups whose value changed since the last frame and send the
+  // frame to the displays. In DISPLAY_SPI build the frame is only queued: the
+  // SPI interrupt shifts it out.
+  void updateAll();
+
+  // Send a frame encoded while the previous one was still being shifted out
+  void service();
+
+  // Send the last frame again, after checking its CRC: a frame changed in RAM
+  // is encoded again whole
+  void refresh();
+
+  // True while a frame is being shifted out
+  boolean busy();
+
+  // Output enable pin, driven also by the SPI interrupt at the end of the frame.
+  // Enabled, the pin carries the brightness PWM.
+  void outputEnable(boolean enable);
+
+  // Digits of the last frame
+  uint8_t digits();
+
+  // Statistics: digits encoded and digits skipped because their group was unchanged
+  uint32_t digitsEncoded;
+  uint32_t digitsSkipped;
+
+private:
+  // State of a layout group
+  struct Group {
+    boolean enabled;
+    boolean dirty;
+    uint8_t blank;      // Digits always blank, bit 0 the leftmost
+    uint8_t dots;       // Digits with the decimal point lit, bit 0 the leftmost
+    uint16_t shown;     // Value encoded in the frame
+  };
+
+  void encode();
+  void encodeGroup(const LayoutGroup &layoutGroup, Group &group, byte *digit);
+  void swap();
+  void send();
+  uint16_t crc();
+
+  const LayoutGroup *layout;
+  const char *text;
+  uint8_t textGroup;
+  Group groups[DISPLAY_MAX_GROUPS];
+  uint8_t groupCount;
+  byte frames[2][DISPLAY_MAX_DIGITS];
+  uint8_t front;        // Frame sent last, the other one is the back buffer
+  uint8_t frameSize;
+  boolean framePending; // Back buffer encoded, not yet sent
+  uint16_t frameCrc;    // CRC of the front frame
+  boolean layoutChanged;
+  DisplayChain *next;   // Next chain attached
+
+  uint8_t dataPin;
+  uint8_t clockPin;
+  uint8_t enablePin;
+  uint8_t enableLevel;
+};
+
+#ifdef DISPLAY_SPI
+// Frame being shifted out by the SPI interrupt, from the last byte backward
+volatile const byte *spiFrameByte;
+volatile uint8_t spiFrameLeft = 0;
+#endif
+
+DisplayChain::DisplayChain(uint8_t dataPin, uint8_t clockPin, uint8_t enablePin, uint8_t enableLevel) :
+    digitsEncoded(0), digitsSkipped(0), layout(NULL), text(NULL), textGroup(0), groupCount(0), front(0), frameSize(0), framePending(false),
+    frameCrc(0), layoutChanged(true), next(NULL), dataPin(dataPin), clockPin(clockPin),
+    enablePin(enablePin), enableLevel(enableLevel) {
+}
+
+void DisplayChain::begin() {
+  halPinOutput(enablePin);
+  halPwmInit(enableLevel == LOW);
+  outputEnable(false);
+
+#ifdef DISPLAY_SPI
+  halSpiInit();
+#else
+  for (DisplayChain *chain = this; chain != NULL; chain = chain->next) {
+    halPinOutput(chain->dataPin);
+  }
+  halPinOutput(clockPin);
+#endif
+}
+
+void DisplayChain::attach(DisplayChain *chain) {
+  DisplayChain *last = this;
+
+  while (last->next != NULL) {
+    last = last->next;
+  }
+  last->next = chain;
+}
+
+uint8_t DisplayChain::digits() {
+  return frameSize;
+}
+
+void DisplayChain::setLayout(const LayoutGroup *layout, uint8_t count) {
+  this->layout = layout;
+  groupCount = count < DISPLAY_MAX_GROUPS ? count : DISPLAY_MAX_GROUPS;
+
+  for (uint8_t g = 0; g < groupCount; g++) {
+    groups[g].enabled = true;
+    groups[g].blank = 0;
+    groups[g].dots = 0;
+  }
+  layoutChanged = true;
+}
+
+void DisplayChain::enableGroup(uint8_t index, boolean enable) {
+  if (index < groupCount) {
+    groups[index].enabled = enable;
+    groups[index].dirty = true;
+  }
+}
+
+void DisplayChain::blankDigits(uint8_t index, uint8_t mask) {
+  if (index < groupCount && groups[index].blank != mask) {
+    groups[index].blank = mask;
+    groups[index].dirty = true;
+  }
+}
+
+void DisplayChain::dotDigits(uint8_t index, uint8_t mask) {
+  if (index < groupCount && groups[index].dots != mask) {
+    groups[index].dots = mask;
+    groups[index].dirty = true;
+  }
+}
+
+void DisplayChain::showText(uint8_t index, const char *text) {
+  this->text = text;
+  textGroup = index;
+}
+
+void DisplayChain::encodeGroup(const LayoutGroup &layoutGroup, Group &group, byte *digit) {
+  if (!group.enabled || layoutGroup.value == NULL) {
+    memset(digit, 0, layoutGroup.digits);
+  } else {
+    uint16_t value = *layoutGroup.value;
+    byte dot = group.dots != 0 ? fontDot(layoutGroup.font) : 0;
+
+    group.shown = value;
+
+    // Least significant nibble on the right
+    for (uint8_t d = layoutGroup.digits; d > 0; d--) {
+      digit[d - 1] = group.blank & _BV(d - 1) ? 0 : fontGlyph(layoutGroup.font, '0' + (value & 0x0F));
+      if (group.dots & _BV(d - 1)) {
+        digit[d - 1] |= dot;
+      }
+      value >>= 4;
+    }
+  }
+  group.dirty = false;
+  digitsEncoded += layoutGroup.digits;
+}
+
+// The frame is kept between updates: only the groups showing a different value
+// (or changed by enableGroup) are encoded again, all of them after a layout change.
+// The groups covered by the text are always encoded, and left dirty to show their
+// value again when the text goes away.
+void DisplayChain::encode() {
+  byte *frame = frames[front ^ 1];
+  const char *c = text;
+  uint8_t pos = 0;
+
+  for (uint8_t g = 0; g < groupCount; g++) {
+    Group &group = groups[g];
+    LayoutGroup layoutGroup;
+
+    memcpy_P(&layoutGroup, &layout[g], sizeof(layoutGroup));
+
+    if (pos + layoutGroup.digits > DISPLAY_MAX_DIGITS) {
+      break;
+    }
+
+    // Groups covered by the text, up to its end
+    if (c != NULL && g >= textGroup && *c != 0) {
+      for (uint8_t d = 0; d < layoutGroup.digits; d++) {
+        frame[pos + d] = *c != 0 ? fontGlyph(layoutGroup.font, *c++) : 0;
+      }
+      group.dirty = true;
+      digitsEncoded += layoutGroup.digits;
+      pos += layoutGroup.digits;
+      continue;
+    }
+
+    if (layoutChanged || group.dirty
+        || (group.enabled && layoutGroup.value != NULL && *layoutGroup.value != group.shown)) {
+      encodeGroup(layoutGroup, group, frame + pos);
+    } else {
+      digitsSkipped += layoutGroup.digits;
+    }
+    pos += layoutGroup.digits;
+  }
+  frameSize = pos;
+  layoutChanged = false;
+}
+
+// The back buffer becomes the front one at once, and starts again from a copy
+// of it: the groups not encoded keep their digits
+void DisplayChain::swap() {
+  front ^= 1;
+  memcpy(frames[front ^ 1], frames[front], frameSize);
+  frameCrc = crc();
+  framePending = false;
+}
+
+// CRC-CCITT of the front frame
+uint16_t DisplayChain::crc() {
+  uint16_t crc = 0xFFFF;
+
+  for (uint8_t i = 0; i < frameSize; i++) {
+    crc = _crc_ccitt_update(crc, frames[front][i]);
+  }
+  return crc;
+}
+
+// The pin output value is always the disabled level, the PWM drives the pin only
+// while connected. Never enabled while the supply is failing: the comparator
+// interrupt can come in the middle of a frame, before its end enables them.
+void DisplayChain::outputEnable(boolean enable) {
+#ifdef POWER_SENSE
+  unsigned char sreg;
+
+  sreg = SREG;
+  cli();
+  enable = enable && !powerDown;
+#endif
+  halPwmOutput(enable);
+  if (!enable) {
+    halPinWrite(enablePin, !enableLevel);
+  }
+#ifdef POWER_SENSE
+  SREG = sreg;
+#endif
+}
+
+boolean DisplayChain::busy() {
+#ifdef DISPLAY_SPI
+  return spiFrameLeft != 0;
+#else
+  return false;
+#endif
+}
+
+void DisplayChain::send() {
+  outputEnable(false);
+
+#ifdef DISPLAY_SPI
+  unsigned char sreg;
+
+  if (frameSize == 0) {
+    outputEnable(true);
+    return;
+  }
+
+  // Queue the frame: the first byte is written here, the others by the interrupt
+  sreg = SREG;
+  cli();
+  spiFrameByte = frames[front] + frameSize - 1;
+  spiFrameLeft = frameSize;
+  halSpiWrite(*spiFrameByte);
+  SREG = sreg;
+#elif defined(DISPLAY_PARALLEL)
+  // Shorter chains get blank bytes first, shifted out beyond their end
+  byte lane[DISPLAY_CHAINS];
+  uint8_t laneMask[DISPLAY_CHAINS];
+  uint8_t dataMask = 0;
+  uint8_t size = 0;
+  uint8_t lanes = 0;
+  DisplayChain *chain;
+
+  for (chain = this; chain != NULL && lanes < DISPLAY_CHAINS; chain = chain->next) {
+    laneMask[lanes++] = _BV(chain->dataPin);
+    dataMask |= _BV(chain->dataPin);
+    if (chain->frameSize > size) {
+      size = chain->frameSize;
+    }
+  }
+
+  for (uint8_t i = size; i > 0; i--) {
+    uint8_t l = 0;
+
+    for (chain = this; l < lanes; chain = chain->next) {
+      lane[l++] = i <= chain->frameSize ? chain->frames[chain->front][i - 1] : 0;
+    }
+    for (uint8_t bit = 0x80; bit != 0; bit >>= 1) {
+      uint8_t bits = 0;
+
+      for (l = 0; l < lanes; l++) {
+        if (lane[l] & bit) {
+          bits |= laneMask[l];
+        }
+      }
+      halBusShift(dataMask, _BV(clockPin), bits);
+    }
+  }
+  outputEnable(true);
+#else
+  for (uint8_t i = frameSize; i > 0; i--) {
+    halShiftOut(dataPin, clockPin, frames[front][i - 1]);
+  }
+  outputEnable(true);
+#endif
+}
+
+// The back buffer is never being shifted out: the frame is encoded at once,
+// with the values of this loop pass, and sent as soon as the chain is free
+void DisplayChain::updateAll() {
+  for (DisplayChain *chain = this; chain != NULL; chain = chain->next) {
+    chain->encode();
+  }
+  framePending = true;
+  service();
+}
+
+void DisplayChain::service() {
+  if (framePending && !busy()) {
+    for (DisplayChain *chain = this; chain != NULL; chain = chain->next) {
+      chain->swap();
+    }
+    send();
+  }
+}
+
+void DisplayChain::refresh() {
+  boolean changed = false;
+
+  if (framePending || busy()) {
+    return;
+  }
+  for (DisplayChain *chain = this; chain != NULL; chain = chain->next) {
+    if (chain->crc() != chain->frameCrc) {
+      chain->layoutChanged = true;
+      changed = true;
+    }
+  }
+  if (changed) {
+    updateAll();
+  } else {
+    send();
+  }
+}
+
+// Different output enable state for different type of shift register
+#ifdef PROTOTYPE
+#define DISPLAY_ENABLE_LEVEL    LOW
+#else
+#define DISPLAY_ENABLE_LEVEL    HIGH
+#endif
+
+DisplayChain disManager(PIN_COM_DATA, PIN_COM_CLOCK, PIN_OUTPUT_ENABLE, DISPLAY_ENABLE_LEVEL);
+
+#ifdef DISPLAY_PARALLEL
+DisplayChain mirrorChain(PIN_MIRROR_DATA, PIN_COM_CLOCK, PIN_OUTPUT_ENABLE, DISPLAY_ENABLE_LEVEL);
+DisplayChain panelChain(PIN_PANEL_DATA, PIN_COM_CLOCK, PIN_OUTPUT_ENABLE, DISPLAY_ENABLE_LEVEL);
+#endif
+
+// Layouts of the sport on every chain: the mirror repeats the main chain
+void displayLayout() {
+  disManager.setLayout(sport.layout, sport.layoutGroups);
+#ifdef DISPLAY_PARALLEL
+  mirrorChain.setLayout(sport.layout, sport.layoutGroups);
+  if (sport.setsToWin != 0) {
+    panelChain.setLayout(layoutPanelSets, LAYOUT_GROUPS(layoutPanelSets));
+  } else {
+    panelChain.setLayout(layoutPanelTime, LAYOUT_GROUPS(layoutPanelTime));
+  }
+#endif
+}
+
+// Digits of the clock seconds group blank and decimal points of the minutes group
+// (time layout), on every chain
+void displayClockFormat(uint8_t blank, uint8_t dots) {
+  disManager.blankDigits(CLOCK_RIGHT_GROUP, blank);
+  disManager.dotDigits(CLOCK_LEFT_GROUP, dots);
+#ifdef DISPLAY_PARALLEL
+  mirrorChain.blankDigits(CLOCK_RIGHT_GROUP, blank);
+  mirrorChain.dotDigits(CLOCK_LEFT_GROUP, dots);
+  panelChain.blankDigits(PANEL_CLOCK_RIGHT_GROUP, blank);
+  panelChain.dotDigits(PANEL_CLOCK_LEFT_GROUP, dots);
+#endif
+}
+
+// Text from the main chain group "group" on, NULL for none: the time panel
+// shows it from its first group
+void displayText(uint8_t group, const char *text) {
+  disManager.showText(group, text);
+#ifdef DISPLAY_PARALLEL
+  mirrorChain.showText(group, text);
+  panelChain.showText(0, text);
+#endif
+}
+
+// Clock groups, shot clock and text from the countdown channels "clocks": the
+// clock groups show the timeout or the interval while the game is stopped
+void displayValues(const Countdown *clocks) {
+  uint8_t clockChannel = CD_GAME;
+
+  if (!clocks[CD_GAME].running) {
+    if (clocks[CD_TIMEOUT].running) {
+      clockChannel = CD_TIMEOUT;
+    } else if (clocks[CD_INTERVAL].running) {
+      clockChannel = CD_INTERVAL;
+    }
+  }
+
+  // Last minute of a countdown: "SS.t", seconds on the minutes group with the
+  // decimal point, tenths on the left digit of the seconds group (the setup mode
+  // always shows minutes and seconds). The BCD clock is rounded up, these
+  // seconds are the whole ones left.
+  if (setSport()) {
+    // No clock in the layout
+  } else if (clocks[clockChannel].sec < CLOCK_TENTHS_BELOW && !setupMode
+      && !(clockChannel == CD_GAME && sport.countUp)) {
+    clockDigits.left = toBcd(clocks[clockChannel].sec);
+    clockDigits.right = clocks[clockChannel].tenth << 4;
+    displayClockFormat(_BV(1), _BV(1));
+  } else {
+    clockDigits.left = clocks[clockChannel].clock >> 8;
+    clockDigits.right = clocks[clockChannel].clock & 0xFF;
+    displayClockFormat(0, 0);
+  }
+  shotDigits = clocks[CD_SHOT].clock & 0xFF;
+
+  // Text over the values: a timed message, or the end of the game time
+  if (messageDuration != 0) {
+    displayText(messageGroup, messageText);
+  } else if (!setSport() && !setupMode && clockChannel == CD_GAME
+      && clocks[CD_GAME].sec == 0 && clocks[CD_GAME].tenth == 0) {
+    strcpy_P(messageText, PSTR("End"));
+    displayText(CLOCK_LEFT_GROUP, messageText);
+  } else {
+    displayText(0, NULL);
+  }
+}
+
+// SPI transfer complete: shift out the next byte of the frame, enable the
+// displays at the end of the frame
+inline void onSpiComplete() {
+#ifdef DISPLAY_SPI
+  if (--spiFrameLeft != 0) {
+    spiFrameByte--;
+    halSpiWrite(*spiFrameByte);
+  } else {
+    disManager.outputEnable(true);
+    events |= EVENT_FRAME;
+  }
+#endif
+}
+
+// #########################################################
+// ################## Display brightness ###################
+// #########################################################
+
+// Move the brightness to the gamma table step "target", fading or at once
+void brightnessSet(uint8_t target, boolean fade) {
+  unsigned char sreg;
+
+  sreg = SREG;
+  cli();
+  brightnessTarget = target;
+  if (!fade) {
+    brightnessStep = target;
+    halPwmDuty(pgm_read_byte(&brightnessGamma[target]));
+  }
+  halPwmInterrupt(brightnessStep != target);
+  SREG = sreg;
+}
+
+// Operator level, lowered while idle
+void brightnessUpdate(boolean fade) {
+  uint8_t target = brightnessLevel * (BRIGHTNESS_STEPS / BRIGHTNESS_LEVELS) - 1;
+
+  if (brightnessDimmed && target > BRIGHTNESS_IDLE) {
+    target = BRIGHTNESS_IDLE;
+  }
+  brightnessSet(target, fade);
+}
+
+// Activity on the control panel: back to the operator level
+void brightnessWake() {
+  activityTime = halMillis();
+  if (brightnessDimmed) {
+    brightnessDimmed = false;
+    brightnessUpdate(true);
+  }
+}
+
+// Fade in from dark
+void brightnessFadeIn() {
+  brightnessSet(0, false);
+  brightnessUpdate(true);
+}
+
+// One fade step every FADE_OVERFLOWS PWM cycles, the interrupt is disabled at
+// the target: no cost out of the fades
+inline void onPwmOverflow() {
+  static uint8_t overflows = 0;
+
+  if (++overflows < FADE_OVERFLOWS) {
+    return;
+  }
+  overflows = 0;
+
+  if (brightnessStep < brightnessTarget) {
+    brightnessStep++;
+  } else if (brightnessStep > brightnessTarget) {
+    brightnessStep--;
+  }
+  halPwmDuty(pgm_read_byte(&brightnessGamma[brightnessStep]));
+  if (brightnessStep == brightnessTarget) {
+    halPwmInterrupt(false);
+  }
+}
+
+#ifdef BENCHMARK
+// Time from reset (after the bootloader) to the first frame sent by setup()
+unsigned long bootFrameTime;
+
+// Prints the cycles spent by the loop to send a frame, and the cycles until the
+// frame is completely shifted out (the same in bit bang output). The parallel
+// output is compared with the single chain bit bang of the main frame.
+void benchmarkDisplay() {
+  unsigned long start;
+  unsigned long loopTime = 0;
+  unsigned long frameTime = 0;
+#ifdef DISPLAY_PARALLEL
+  unsigned long singleTime;
+#endif
+
+  for (uint8_t i = 0; i < BENCHMARK_FRAMES; i++) {
+    start = halMicros();
+    disManager.updateAll();
+    loopTime += halMicros() - start;
+    while (disManager.busy()) {
+    }
+    frameTime += halMicros() - start;
+  }
+
+#ifdef DISPLAY_SPI
+  halPrint("SPI");
+#elif defined(DISPLAY_PARALLEL)
+  halPrint("PARALLEL ");
+  halPrint(DISPLAY_CHAINS);
+  halPrint(" chains");
+#else
+  halPrint("BIT BANG");
+#endif
+  halPrint(" updateAll cycles = ");
+  halPrint(loopTime * clockCyclesPerMicrosecond() / BENCHMARK_FRAMES);
+  halPrint(", frame cycles = ");
+  halPrintln(frameTime * clockCyclesPerMicrosecond() / BENCHMARK_FRAMES);
+
+#ifdef DISPLAY_PARALLEL
+  // Blank bytes on the main chain, outputs disabled until the next frame
+  disManager.outputEnable(false);
+  start = halMicros();
+  for (uint8_t i = 0; i < BENCHMARK_FRAMES; i++) {
+    for (uint8_t d = disManager.digits(); d > 0; d--) {
+      halShiftOut(PIN_COM_DATA, PIN_COM_CLOCK, 0);
+    }
+  }
+  singleTime = halMicros() - start;
+  disManager.updateAll();
+  halPrint("BIT BANG single chain shift cycles = ");
+  halPrintln(singleTime * clockCyclesPerMicrosecond() / BENCHMARK_FRAMES);
+#endif
+  halPrint("Digits encoded = ");
+  halPrint(disManager.digitsEncoded);
+  halPrint(", skipped = ");
+  halPrintln(disManager.digitsSkipped);
+  halPrint("First frame at ");
+  halPrint(bootFrameTime);
+  halPrintln(" us");
+}
+
+// Clock digits from the seconds left: divisions by 60 and 10 against the BCD
+// clock step, over a 10 minutes countdown. The digits go to a volatile variable
+// to keep the computation.
+volatile uint8_t digit;
+
+void benchmarkClockDigits() {
+  unsigned long start;
+  unsigned long divideTime;
+  unsigned long bcdTime;
+  uint16_t clock = 0x1000;
+
+  start = halMicros();
+  for (uint16_t sec = 600; sec > 0; sec--) {
+    uint16_t left = sec / 60;
+    uint16_t right = sec % 60;
+
+    digit = left / 10;
+    digit = left % 10;
+    digit = right / 10;
+    digit = right % 10;
+  }
+  divideTime = halMicros() - start;
+
+  start = halMicros();
+  for (uint16_t sec = 600; sec > 0; sec--) {
+    clock = bcdClockDecrement(clock);
+    digit = clock >> 12;
+    digit = (clock >> 8) & 0x0F;
+    digit = (clock >> 4) & 0x0F;
+    digit = clock & 0x0F;
+  }
+  bcdTime = halMicros() - start;
+
+  halPrint("Clock digits cycles: divide = ");
+  halPrint(divideTime * clockCyclesPerMicrosecond() / 600);
+  halPrint(", BCD = ");
+  halPrintln(bcdTime * clockCyclesPerMicrosecond() / 600);
+}
+#endif
+
+// #########################################################
+// Configuration of digital buttons on the analog interface
+
+ButtonLadder homeLadder = { HOME_P1, 0, &handleHomeButtons, LADDER_NONE, LADDER_NONE, false, 0, 0 };
+ButtonLadder awayLadder = { AWAY_P1, 0, &handleAwayButtons, LADDER_NONE, LADDER_NONE, false, 0, 0 };
+ButtonLadder timerLadder = { TIMER_START_STOP, _BV(TIMER_RESET - TIMER_START_STOP) | _BV(SETUP_MODE - TIMER_START_STOP),
+  &handleTimerButtons, LADDER_NONE, LADDER_NONE, false, 0, 0 };
+
+// Ladder index of the analog "value", LADDER_NONE out of the button ranges
+uint8_t ladderButton(uint16_t value) {
+  for (uint8_t b = 0; b < LADDER_BUTTONS; b++) {
+    if (value >= pgm_read_word(&bAVal[2 * b]) && value <= pgm_read_word(&bAVal[2 * b + 1])) {
+      return b;
+    }
+  }
+  return LADDER_NONE;
+}
+
+// Nothing read nor pressed on the ladder
+inline boolean ladderIdle(const ButtonLadder &ladder) {
+  return ladder.candidate == LADDER_NONE && ladder.pressed == LADDER_NONE;
+}
+
+// Debounce in time: a button is pressed or released when it has been read on
+// every sample for DEBOUNCE_TIME ms, however often the loop gets here
+void ladderUpdate(ButtonLadder &ladder, uint16_t value, unsigned long now) {
+  uint8_t button = ladderButton(value);
+
+  if (button != ladder.candidate) {
+    ladder.candidate = button;
+    ladder.changeTime = now;
+    return;
+  }
+  if (now - ladder.changeTime < DEBOUNCE_TIME) {
+    return;
+  }
+
+  if (button != ladder.pressed) {
+    // Short press of a button with a held action
+    if (ladder.pressed != LADDER_NONE && (ladder.heldMask & _BV(ladder.pressed)) && !ladder.heldFired) {
+      ladder.handler(ladder.firstId + ladder.pressed, false);
+    }
+    ladder.pressed = button;
+    ladder.pressTime = now;
+    ladder.heldFired = false;
+    if (button != LADDER_NONE && !(ladder.heldMask & _BV(button))) {
+      ladder.handler(ladder.firstId + button, false);
+    }
+  } else if (button != LADDER_NONE && (ladder.heldMask & _BV(button)) && !ladder.heldFired
+      && now - ladder.pressTime >= HELD_TIME) {
+    ladder.heldFired = true;
+    ladder.handler(ladder.firstId + button, true);
+  }
+}
+
+// #########################################################
+// ############ Interrupt driven analog sampling ###########
+// #########################################################
+
+void configureADC() {
+  // First input selected, digital input buffers disabled on the analog inputs
+  halAdcInit(adcChannel[0], _BV(HOME_ANALOG_INPUT) | _BV(AWAY_ANALOG_INPUT) | _BV(TIMER_ANALOG_INPUT));
+}
+
+// Median of three samples: a single spike is discarded
+inline uint16_t median3(uint16_t a, uint16_t b, uint16_t c) {
+  uint16_t t;
+
+  if (a > b) {
+    t = a;
+    a = b;
+    b = t;
+  }
+  return c < a ? a : (c > b ? b : c);
+}
+
+// ADC conversion complete. The next conversion starts on the next Timer0
+// overflow, so the multiplexer written here selects its input.
+inline void onAdcComplete(uint16_t value) {
+  static uint8_t slot = 0;
+  static uint16_t sample[ADC_SLOTS_PER_INPUT];
+  uint8_t index = slot % ADC_SLOTS_PER_INPUT;
+
+  sample[index] = value;
+  if (index == ADC_SLOTS_PER_INPUT - 1) {
+    adcSample[slot / ADC_SLOTS_PER_INPUT] = median3(sample[0], sample[1], sample[2]);
+  }
+
+  // All the inputs sampled: an event while a button is in use, or when an input
+  // leaves the released level
+  if (++slot == ADC_SLOTS) {
+    slot = 0;
+    if (!inputIdle || adcSample[ADC_HOME] > MIN_VALID_ANALOG_VALUE
+        || adcSample[ADC_AWAY] > MIN_VALID_ANALOG_VALUE
+        || adcSample[ADC_TIMER] > MIN_VALID_ANALOG_VALUE) {
+      events |= EVENT_INPUT;
+    }
+  }
+  halAdcSelect(adcChannel[slot / ADC_SLOTS_PER_INPUT]);
+}
+
+// Show "text" (in PROGMEM) from the display group "group" on for "duration" ms
+void showMessage(uint8_t group, const char *text, uint16_t duration) {
+  strncpy_P(messageText, text, DISPLAY_MAX_DIGITS);
+  messageText[DISPLAY_MAX_DIGITS] = 0;
+  messageGroup = group;
+  messageTime = halMillis();
+  messageDuration = duration;
+  updateDisplay = true;
+}
+
+// "SEt n" on the scores after a change of the actual set
+void showSetMessage() {
+  showMessage(0, PSTR("SEt  "), MESSAGE_SET_TIME);
+  messageText[4] = '0' + vSets.actSet;
+}
+
+void setSportMode(uint8_t mode) {
+  memcpy_P(&sport, &sportModes[mode], sizeof(sport));
+  sportIndex = mode;
+  displayLayout();
+  resetTimer();
+  logClear();
+  brightnessFadeIn();
+  updateDisplay = true;
+}
+
+boolean setSport() {
+  return sport.setsToWin != 0;
+}
+
+// A clock counting up runs down the rest of the period: the time shown is the
+// elapsed one
+void setTimer() {
+  uint16_t shown = time.min * 60 + time.sec;
+
+  if (sport.countUp) {
+    countdownSet(CD_GAME, shown < sport.periodLength ? sport.periodLength - shown : 0);
+  } else {
+    countdownSet(CD_GAME, shown);
+  }
+}
+
+void resetTimer() {
+  uint16_t shown = sport.countUp ? 0 : sport.periodLength;
+
+  time.min = shown / 60;
+  time.sec = shown % 60;
+  setTimer();
+}
+
+// #########################################################
+// #################### Game event log #####################
+// #########################################################
+
+// Every button action and remote command is compared with the game values
+// before it: each value changed is a 2 byte event in a ring buffer, the events
+// after the first one of an action linked to it. Undo and redo step along the
+// ring one action at a time, subtracting or adding the changes again; the dump
+// replays the events from the oldest one kept. The running clock is no event,
+// only its changes with the clock stopped are (setup, reset, remote), undone
+// and redone with the clock stopped only.
+
+const char * const logName[LOG_TYPES] = { "score", "score", "sets", "set", "period", "clock" };
+
+uint16_t logEvents[LOG_SIZE];
+uint8_t logHead = 0;          // Next event written
+uint8_t logCount = 0;         // Events before logHead, undo
+uint8_t logUndone = 0;        // Events from logHead on, redo
+
+// Game values before the action
+GameState logState;
+
+// The game clock read with the Timer1 interrupt off, not split by a tick
+void logRead(GameState &state) {
+  unsigned char sreg;
+
+  memset(&state, 0, sizeof(state));
+  state.value[LOG_SCORE * 2] = fromBcd(bScore.home);
+  state.value[LOG_SCORE * 2 + 1] = fromBcd(bScore.away);
+  state.value[LOG_VSCORE * 2] = fromBcd(vScore.home);
+  state.value[LOG_VSCORE * 2 + 1] = fromBcd(vScore.away);
+  state.value[LOG_SETS * 2] = vSets.homeSet;
+  state.value[LOG_SETS * 2 + 1] = vSets.awaySet;
+  state.value[LOG_SET * 2] = vSets.actSet;
+  state.value[LOG_PERIOD * 2] = time.period;
+  sreg = SREG;
+  cli();
+  state.value[LOG_CLOCK * 2] = countdown[CD_GAME].sec;
+  state.running = countdown[CD_GAME].running;
+  SREG = sreg;
+}
+
+// The clock is set only for a clock change undone or redone ("clock", on the
+// stopped clock), within the period: a running clock is left alone
+void logWrite(const GameState &state, boolean clock) {
+  int16_t seconds = state.value[LOG_CLOCK * 2];
+
+  bScore.home = toBcd(state.value[LOG_SCORE * 2]);
+  bScore.away = toBcd(state.value[LOG_SCORE * 2 + 1]);
+  vScore.home = toBcd(state.value[LOG_VSCORE * 2]);
+  vScore.away = toBcd(state.value[LOG_VSCORE * 2 + 1]);
+  vSets.homeSet = state.value[LOG_SETS * 2];
+  vSets.awaySet = state.value[LOG_SETS * 2 + 1];
+  vSets.actSet = state.value[LOG_SET * 2];
+  time.period = state.value[LOG_PERIOD * 2];
+  if (clock) {
+    if (seconds < 0) {
+      seconds = 0;
+    } else if (sport.countUp && seconds > (int16_t) sport.periodLength) {
+      seconds = sport.periodLength;
+    }
+    countdownSet(CD_GAME, seconds);
+  }
+  saveEEprom = true;
+  updateDisplay = true;
+}
+
+// The ring full, the oldest event is overwritten: the events linked to it go
+// as well, no action is kept in part
+void logAdd(uint16_t event) {
+  logEvents[logHead] = event;
+  logHead = (logHead + 1) % LOG_SIZE;
+  if (logCount < LOG_SIZE) {
+    logCount++;
+  } else {
+    while (logCount > 0 && (logEvents[(logHead + LOG_SIZE - logCount) % LOG_SIZE] & LOG_LINKED)) {
+      logCount--;
+    }
+  }
+  logUndone = 0;
+}
+
+void logClear() {
+  logHead = 0;
+  logCount = 0;
+  logUndone = 0;
+  logRead(logState);
+}
+
+// Before an action
+void logBegin() {
+  logRead(logState);
+}
+
+// After an action: its changes, split when out of the event range. A nested
+// action logs them first, leaving nothing to the outer one.
+void logCommit() {
+  GameState state;
+  uint16_t linked = 0;
+
+  logRead(state);
+  for (uint8_t f = 0; f < LOG_FIELDS; f++) {
+    int16_t delta = state.value[f] - logState.value[f];
+
+    if (f == LOG_CLOCK * 2 && (state.running || logState.running)) {
+      continue;
+    }
+    while (delta != 0) {
+      int16_t step = constrain(delta, -LOG_DELTA_MAX, LOG_DELTA_MAX);
+
+      logAdd(LOG_EVENT(f, step) | linked);
+      linked = LOG_LINKED;
+      delta -= step;
+    }
+  }
+  logState = state;
+}
+
+// Events of the action ending before logHead (undo) or starting at it (redo),
+// 0 if it changes the clock while the clock runs: the change was made on the
+// stopped clock, the running one has moved since
+uint8_t logAction(boolean undo) {
+  uint8_t left = undo ? logCount : logUndone;
+  uint8_t events;
+
+  for (events = 0; events < left; events++) {
+    uint16_t event = logEvents[(undo ? logHead + LOG_SIZE - 1 - events : logHead + events) % LOG_SIZE];
+
+    if (!undo && events > 0 && !(event & LOG_LINKED)) {
+      break;                    // First event of the next action
+    }
+    if (LOG_TYPE(event) == LOG_CLOCK && countdown[CD_GAME].running) {
+      return 0;
+    }
+    if (undo && !(event & LOG_LINKED)) {
+      return events + 1;        // First event of the action
+    }
+  }
+  return events;
+}
+
+// Undo the last action: false if none is left, or if it changed the clock and
+// the clock runs (stop it first)
+boolean logUndo() {
+  GameState state;
+  uint8_t events = logAction(true);
+  uint16_t event;
+  boolean clock = false;
+
+  if (events == 0) {
+    return false;
+  }
+  logRead(state);
+  for (; events > 0; events--) {
+    logHead = (logHead + LOG_SIZE - 1) % LOG_SIZE;
+    logCount--;
+    logUndone++;
+    event = logEvents[logHead];
+    state.value[LOG_FIELD(event)] -= LOG_DELTA(event);
+    clock |= LOG_TYPE(event) == LOG_CLOCK;
+  }
+  logWrite(state, clock);
+  logRead(logState);
+  return true;
+}
+
+// Redo the last action undone: false as for logUndo
+boolean logRedo() {
+  GameState state;
+  uint8_t events = logAction(false);
+  uint16_t event;
+  boolean clock = false;
+
+  if (events == 0) {
+    return false;
+  }
+  logRead(state);
+  for (; events > 0; events--) {
+    event = logEvents[logHead];
+    state.value[LOG_FIELD(event)] += LOG_DELTA(event);
+    clock |= LOG_TYPE(event) == LOG_CLOCK;
+    logHead = (logHead + 1) % LOG_SIZE;
+    logCount++;
+    logUndone--;
+  }
+  logWrite(state, clock);
+  logRead(logState);
+  return true;
+}
+
+// Points of the period (sets sports: score of the set) from "start" on
+void printLogPeriod(const GameState &state, const int16_t *start) {
+  uint8_t score = setSport() ? LOG_VSCORE * 2 : LOG_SCORE * 2;
+
+  halPrint(setSport() ? "--- Set " : "--- Period ");
+  halPrint(state.value[setSport() ? LOG_SET * 2 : LOG_PERIOD * 2]);
+  halPrint(": ");
+  halPrint(state.value[score] - start[0]);
+  halPrint(" - ");
+  halPrintln(state.value[score + 1] - start[1]);
+}
+
+// Play by play from the oldest event kept, with the score of every period
+void printLog() {
+  GameState state;
+  uint8_t score = setSport() ? LOG_VSCORE * 2 : LOG_SCORE * 2;
+  uint8_t period = setSport() ? LOG_SET : LOG_PERIOD;
+  uint8_t index = (logHead + LOG_SIZE - logCount) % LOG_SIZE;
+  int16_t start[2] = { 0, 0 };
+
+  // Values before the oldest event
+  logRead(state);
+  for (uint8_t i = 0; i < logCount; i++) {
+    uint16_t event = logEvents[(index + i) % LOG_SIZE];
+
+    state.value[LOG_FIELD(event)] -= LOG_DELTA(event);
+  }
+  if (!setSport()) {
+    start[0] = state.value[score];
+    start[1] = state.value[score + 1];
+  }
+
+  halPrintln("###############################");
+  halPrintln("######## PLAY BY PLAY #########");
+  halPrint("events = ");
+  halPrint(logCount);
+  halPrint(", undone = ");
+  halPrintln(logUndone);
+
+  for (uint8_t i = 0; i < logCount; i++) {
+    uint16_t event = logEvents[(index + i) % LOG_SIZE];
+    uint8_t field = LOG_FIELD(event);
+    int16_t delta = LOG_DELTA(event);
+
+    if (LOG_TYPE(event) == period) {
+      printLogPeriod(state, start);
+    }
+    state.value[field] += delta;
+    if (LOG_TYPE(event) == period && !setSport()) {
+      start[0] = state.value[score];
+      start[1] = state.value[score + 1];
+    }
+
+    halPrint(i + 1);
+    halPrint(event & LOG_LINKED ? "   " : " ");
+    halPrint(logName[LOG_TYPE(event)]);
+    if (LOG_TYPE(event) <= LOG_SETS) {
+      halPrint(field & 1 ? " away " : " home ");
+    } else {
+      halPrint(" ");
+    }
+    if (delta > 0) {
+      halPrint("+");
+    }
+    halPrint(delta);
+    halPrint(" = ");
+    halPrintln(state.value[field]);
+  }
+  printLogPeriod(state, start);
+}
+
+// #########################################################
+// ################# Button action dispatch ################
+// #########################################################
+
+// Every button press is looked up in buttonActions by mode (setup, sets),
+// button and held flag: the entry is an action handler and its argument. The
+// team of the score actions is the one of the button.
+
+void actScoreAdd(uint8_t team, uint8_t points) {
+  uint16_t &score = team == 0 ? bScore.home : bScore.away;
+
+  while (points-- > 0) {
+    score = bcdIncrement(score);
+  }
+  saveEEprom = true;
+}
+
+void actScoreSub(uint8_t team) {
+  uint16_t &score = team == 0 ? bScore.home : bScore.away;
+
+  if (score > 0) {
+    score = bcdDecrement(score);
+    saveEEprom = true;
+  }
+}
+
+void actVolleyScoreAdd(uint8_t team) {
+  uint16_t &score = team == 0 ? vScore.home : vScore.away;
+
+  score = bcdIncrement(score);
+  saveEEprom = true;
+}
+
+void actVolleyScoreSub(uint8_t team) {
+  uint16_t &score = team == 0 ? vScore.home : vScore.away;
+
+  if (score > 0) {
+    score = bcdDecrement(score);
+    saveEEprom = true;
+  }
+}
+
+void actSetAdd(uint8_t team) {
+  if (vSets.homeSet < sport.setsToWin && vSets.awaySet < sport.setsToWin) {
+    if (team == 0) {
+      vSets.homeSet++;
+    } else {
+      vSets.awaySet++;
+    }
+    saveEEprom = true;
+  }
+}
+
+void actSetSub(uint8_t team) {
+  uint16_t &sets = team == 0 ? vSets.homeSet : vSets.awaySet;
+
+  if (sets > 0) {
+    sets--;
+    saveEEprom = true;
+  }
+}
+
+// Setup mode: minutes, wrapping after the sport limit
+void actMinuteAdd() {
+  if (time.min >= sport.maxMinutes) {
+    time.min = 0;
+  } else {
+    time.min++;
+  }
+  setTimer();
+}
+
+// Setup mode: seconds, wrapping after 59
+void actSecondAdd(uint8_t seconds) {
+  time.sec = (time.sec + seconds) % 60;
+  setTimer();
+}
+
+void actSecondSub() {
+  if (time.sec == 0) {
+    time.sec = 59;
+  } else {
+    time.sec--;
+  }
+  setTimer();
+}
+
+void actStartStop() {
+  if (countdown[CD_GAME].running) {
+    countdownRun(CD_GAME, false);
+    saveEEprom = true;
+  } else if (countdownRun(CD_GAME, true)) {
+    // The game restarts: end of timeout or interval
+    countdownRun(CD_TIMEOUT, false);
+    countdownRun(CD_INTERVAL, false);
+  }
+}
+
+// Held with the clock stopped resets game and shot clocks, with the clock
+// running the shot clock to the short time
+void actClockReset() {
+  if (!countdown[CD_GAME].running) {
+    resetTimer();
+    countdownSet(CD_SHOT, SHOT_CLOCK);
+  } else {
+    countdownSet(CD_SHOT, SHOT_CLOCK_SHORT);
+  }
+}
+
+void actPeriodNext() {
+  if (time.period >= sport.periods) {
+    time.period = 1;
+  } else {
+    time.period++;
+  }
   saveEEprom = true;
 }
 
-// #########################################################
-// ####### EEPROM wear leveling algorithm functions ########
-// #########################################################
+void actSetNext() {
+  if (vSets.actSet >= sport.periods) {
+    vSets.actSet = 1;
+  } else {
+    vSets.actSet++;
+  }
+  saveEEprom = true;
+  showSetMessage();
+}
+
+// Setup mode: reload the values from the EEPROM journal (basketball)
+void actReload() {
+  bScore.home = toBcd(dataEE.score.home);
+  bScore.away = toBcd(dataEE.score.away);
+  time = dataEE.time;
+  setTimer();
+}
+
+// Setup mode: change of current time and reload values from EEPROM memory
+void actSetupEnter() {
+  if (!countdown[CD_GAME].running) {
+    setupMode = true;
+  }
+}
+
+void actSetupExit() {
+  if (!countdown[CD_GAME].running) {
+    setupMode = false;
+    saveEEprom = true;
+  }
+}
+
+void buttonAction(int id, boolean held) {
+  uint8_t mode = (setupMode ? 2 : 0) + (setSport() ? 1 : 0);
+  uint8_t action;
+  uint8_t team;
+
+  if (id < HOME_P1 || id > SETUP_MODE) {
+    return;
+  }
+  action = pgm_read_byte(&buttonActions[mode][id - HOME_P1][held ? 1 : 0]);
+  team = (id - HOME_P1) / 4;
+
+  updateDisplay = true;
+  brightnessWake();
+
+  // Chords with SETUP_MODE kept pressed (out of setup mode): HOME_M1 undo,
+  // AWAY_M1 redo, HOME_P1 play by play dump. SETUP_MODE has no action then.
+  if (!setupMode && id != SETUP_MODE && timerLadder.pressed == SETUP_MODE - TIMER_START_STOP) {
+    timerLadder.heldFired = true;
+    if (id == HOME_M1) {
+      logUndo();
+    } else if (id == AWAY_M1) {
+      logRedo();
+    } else if (id == HOME_P1) {
+      printLog();
+    }
+    return;
+  }
+
+  logBegin();
+  switch (ACTION_HANDLER(action)) {
+    case ACT_SCORE_ADD:
+      actScoreAdd(team, ACTION_ARG(action));
+      break;
+    case ACT_SCORE_SUB:
+      actScoreSub(team);
+      break;
+    case ACT_VSCORE_ADD:
+      actVolleyScoreAdd(team);
+      break;
+    case ACT_VSCORE_SUB:
+      actVolleyScoreSub(team);
+      break;
+    case ACT_SET_ADD:
+      actSetAdd(team);
+      break;
+    case ACT_SET_SUB:
+      actSetSub(team);
+      break;
+    case ACT_MINUTE_ADD:
+      actMinuteAdd();
+      break;
+    case ACT_SECOND_ADD:
+      actSecondAdd(ACTION_ARG(action));
+      break;
+    case ACT_SECOND_SUB:
+      actSecondSub();
+      break;
+    case ACT_START_STOP:
+      actStartStop();
+      break;
+    case ACT_SHOT_RESET:
+      countdownSet(CD_SHOT, SHOT_CLOCK);
+      break;
+    case ACT_CLOCK_RESET:
+      actClockReset();
+      break;
+    case ACT_SCORE_RESET:
+      bScore.home = 0;
+      bScore.away = 0;
+      break;
+    case ACT_VSCORE_RESET:
+      vScore.home = 0;
+      vScore.away = 0;
+      saveEEprom = true;
+      break;
+    case ACT_PERIOD_NEXT:
+      actPeriodNext();
+      break;
+    case ACT_SET_NEXT:
+      actSetNext();
+      break;
+    case ACT_RELOAD:
+      actReload();
+      break;
+    case ACT_SETUP_ENTER:
+      actSetupEnter();
+      break;
+    case ACT_SETUP_EXIT:
+      actSetupExit();
+      break;
+    case ACT_PRINT_EEPROM:
+      printEEPROM();
+      break;
+    case ACT_PRINT_PROFILE:
+#ifdef PROFILER
+      printProfile();
+#endif
+      break;
+    case ACT_HORN:
+      buzzerManCmd = true;
+      break;
+    case ACT_NEXT_SPORT:
+      setSportMode((sportIndex + 1) % SPORT_MODES);
+      setupMode = false;
+      saveEEprom = true;
+      break;
+    case ACT_BRIGHTNESS:
+      brightnessLevel = brightnessLevel % BRIGHTNESS_LEVELS + 1;
+      brightnessUpdate(true);
+      break;
+  }
+  logCommit();
+}
+
+void handleHomeButtons(int id, boolean held) {
+
+#ifdef DEBUG
+  halPrint("HOME = ");
+  halPrint(id);
+  halPrint(",  HELD = ");
+  halPrintln(held);
+#endif
+
+  buttonAction(id, held);
+}
+
+void handleAwayButtons(int id, boolean held) {
+
+#ifdef DEBUG
+  halPrint("AWAY = ");
+  halPrint(id);
+  halPrint(",  HELD = ");
+  halPrintln(held);
+#endif
+
+  buttonAction(id, held);
+}
+
+void handleTimerButtons(int id, boolean held) {
+
+#ifdef DEBUG
+  halPrint("TIMER = ");
+  halPrint(id);
+  halPrint(",  HELD = ");
+  halPrintln(held);
+#endif
+
+  buttonAction(id, held);
+}
+
+inline void onTimerTick() {
+#ifdef PROFILER
+  if (!profileTick) {
+    profileTickTime = halMicros();
+    profileTick = true;
+  }
+#endif
+  for (uint8_t c = 0; c < CD_CHANNELS; c++) {
+    volatile Countdown &cd = countdown[c];
+
+    if (!cd.running) {
+      continue;
+    }
+
+    // Stopped with the master channel, also when it reached zero in this tick
+    if (cd.link != CD_NONE && !countdown[cd.link].running) {
+      cd.running = false;
+      continue;
+    }
+
+    // The clock steps when a whole second elapsed: on the tenths reaching zero
+    if (cd.tenth == 0) {
+      cd.sec--;
+      cd.tenth = 9;
+    } else if (--cd.tenth == 0) {
+      cd.clock = cd.countUp ? bcdClockIncrement(cd.clock) : bcdClockDecrement(cd.clock);
+    }
+
+    // Stop on zero here, the loop fires the buzzer (and saves the end of the
+    // game clock)
+    if (cd.sec == 0 && cd.tenth == 0) {
+      cd.running = false;
+      cd.expired = true;
+      if (c == CD_GAME) {
+        saveEEprom = true;
+      }
+    }
+    updateDisplay = true;
+  }
+
+  events |= EVENT_TICK;
+
+  // One EEPROM record every game clock second, every minute when the power fail
+  // handler saves the last state (the BCD clock seconds at 00, just stepped)
+#ifdef POWER_SENSE
+  if (countdown[CD_GAME].running && (countdown[CD_GAME].clock & 0xFF) == 0
+      && countdown[CD_GAME].tenth == 0) {
+    saveEEprom = true;
+  }
+#else
+  if (countdown[CD_GAME].running && countdown[CD_GAME].tenth == 0) {
+    saveEEprom = true;
+  }
+#endif
+}
+
+#ifdef POWER_SENSE
+// Supply falling: shed the display and buzzer load at once to stretch the
+// hold-up time, the loop writes the last record
+inline void onPowerFail() {
+  powerDown = true;
+  disManager.outputEnable(false);
+  halPinWrite(BUZZER_OUTPUT, HIGH);
+  events |= EVENT_POWER;
+}
+#endif
+
+void countdownSet(uint8_t channel, uint16_t seconds) {
+  volatile Countdown &cd = countdown[channel];
+  uint16_t clock;
+  boolean countUp;
+  unsigned char sreg;
+
+  // Converted here once, the tick steps the BCD clock
+  countUp = channel == CD_GAME && sport.countUp;
+  clock = toBcdClock(countUp ? sport.periodLength - seconds : seconds);
+
+  sreg = SREG;
+  cli();
+  cd.sec = seconds;
+  cd.tenth = 0;
+  cd.clock = clock;
+  cd.countUp = countUp;
+  cd.expired = false;
+  if (seconds == 0) {
+    cd.running = false;
+  }
+  SREG = sreg;
+  updateDisplay = true;
+}
+
+uint16_t countdownLength(uint8_t channel) {
+  switch (channel) {
+    case CD_SHOT:
+      return SHOT_CLOCK;
+    case CD_TIMEOUT:
+      return TIMEOUT_TIME;
+    case CD_INTERVAL:
+      return time.period == sport.halftimeAfter ? HALFTIME_TIME : INTERVAL_TIME;
+  }
+  return sport.periodLength;
+}
+
+boolean countdownRun(uint8_t channel, boolean run) {
+  uint8_t link = countdown[channel].link;
+  boolean stopped = true;
+  unsigned char sreg;
+
+  if (run && link != CD_NONE && !countdown[link].running) {
+    return false;
+  }
+
+  sreg = SREG;
+  cli();
+  for (uint8_t c = 0; c < CD_CHANNELS; c++) {
+    stopped &= !countdown[c].running;
+  }
+  for (uint8_t c = 0; c < CD_CHANNELS; c++) {
+    volatile Countdown &cd = countdown[c];
+
+    if ((c == channel || cd.link == channel) && (!run || cd.sec != 0 || cd.tenth != 0)) {
+      cd.running = run;
+    }
+  }
+
+  // First countdown started: its first tenth lasts a whole Timer1 period, and
+  // the clock reaches zero exactly its time after the start
+  if (run && stopped && countdown[channel].running) {
+    halTimer1Restart();
+  }
+  SREG = sreg;
+  updateDisplay = true;
+  return countdown[channel].running == run;
+}
+
+// #########################################################
+// ############ EEPROM journal functions ###########
+// #########################################################
+
+// CRC of the record: the bytes before the "crc" field
+uint16_t crcEEPROM(const persistentData &data) {
+  const uint8_t *byte = (const uint8_t*) &data;
+  uint16_t crc = _crc_ccitt_update(0xFFFF, EEPROM_LAYOUT);
+
+  while (byte < (const uint8_t*) &data.crc) {
+    crc = _crc_ccitt_update(crc, *byte++);
+  }
+  return crc;
+}
+
+// Read the record "index" of the journal: false if erased or torn by a power loss
+boolean readRecordEEPROM(uint16_t index, persistentData &data) {
+  halEepromRead((void*) &data, index * sizeof(data), sizeof(data));
+
+  return data.counter != 0xFFFFFFFF && data.crc == crcEEPROM(data);
+}
+
+// Erase the journal
+void resetEEPROM() {
+  for (uint16_t i = 0; i < EEPROM_SIZE; i++) {
+    halEepromUpdate(i, 0xFF);
+  }
+}
+
+// The journal is written in ring order, so from the record 0 the sequence numbers
+// grow up to the newest record; after it there are one record possibly torn,
+// and then only erased records or records of the previous round, all older than
+// the record 0. "Valid and not older than record 0" holds from record 0 up to
+// the newest record and never after it: binary search for its last record.
+boolean initializeEEPROM() {
+  persistentData data;
+  uint32_t first;
+  uint16_t low = 0;
+  uint16_t high = EEPROM_RECORDS - 1;
+  uint16_t mid;
+
+  if (readRecordEEPROM(0, data)) {
+    first = data.counter;
+
+    while (low < high) {
+      mid = (low + high + 1) / 2;
+
+      if (readRecordEEPROM(mid, data) && data.counter >= first) {
+        low = mid;
+      } else {
+        high = mid - 1;
+      }
+    }
+    readRecordEEPROM(low, data);
+  } else if (readRecordEEPROM(EEPROM_RECORDS - 1, data)) {
+    // Record 0 torn while starting a new round
+    low = EEPROM_RECORDS - 1;
+  } else {
+    // Empty journal: the first record will be written at offset 0
+    data.counter = 0;
+    data.score.home = 0;
+    data.score.away = 0;
+    data.time.min = TIMER_INIT_MIN;
+    data.time.sec = TIMER_INIT_SEC;
+    data.time.period = 1;
+    data.mode = SPORT_BASKETBALL;
+    data.vScore[0] = 0;
+    data.vScore[1] = 0;
+    data.vSets[0] = 1;
+    data.vSets[1] = 0;
+    data.vSets[2] = 0;
+    low = EEPROM_RECORDS - 1;
+  }
+
+  counterEE = data.counter;
+  offsetEE = low * sizeof(data);
+  dataEE = data;
+
+  return counterEE / EEPROM_RECORDS < EEPROM_MAX_WRITE;
+}
+
+// Write "data" as the record "counterEE" at "offsetEE" (interrupts disabled).
+// The CRC covers the bytes of targetEE, the ones written.
+void targetRecordEEPROM(const persistentData &data) {
+  targetEE = data;
+  targetEE.counter = counterEE;
+  targetEE.crc = crcEEPROM(targetEE);
+
+  // Compare with the old record in the cell, or write all the bytes if the
+  // last byte written is still in progress
+  if (halEepromReady()) {
+    halEepromRead((void*) &committedEE, offsetEE, sizeof(committedEE));
+  } else {
+    for (uint8_t i = 0; i < sizeof(targetEE); i++) {
+      ((uint8_t*) &committedEE)[i] = ~((const uint8_t*) &targetEE)[i];
+    }
+  }
+
+  indexEE = 0;
+  pendingEE = true;
+  halEepromInterrupt(true);
+}
+
+// Start the record after the newest one with "data" (interrupts disabled)
+void startRecordEEPROM(const persistentData &data) {
+  counterEE++;
+  offsetEE += sizeof(data);
+  if (offsetEE + sizeof(data) > EEPROM_SIZE) {
+    offsetEE = 0;
+  }
+  targetRecordEEPROM(data);
+}
+
+boolean writeEEPROM(boolean last) {
+  persistentData data;
+  unsigned char sreg;
+
+  if (counterEE / EEPROM_RECORDS >= EEPROM_MAX_WRITE) {
+    return false;
+  }
+
+  data.score.home = fromBcd(bScore.home);
+  data.score.away = fromBcd(bScore.away);
+  data.time = time;
+  data.mode = sportIndex;
+  data.vScore[0] = fromBcd(vScore.home);
+  data.vScore[1] = fromBcd(vScore.away);
+  data.vSets[0] = vSets.actSet;
+  data.vSets[1] = vSets.homeSet;
+  data.vSets[2] = vSets.awaySet;
+
+  // Power fail: the record being written, if any, is written again with the
+  // last values, compared with the cell once its byte in progress is done.
+  // One record fits the hold-up time, a second one would not: 22 bytes at most
+  // (75 ms, 58 ms in a cell written before, the high bytes of score and time
+  // being always 0) after the byte in progress (3.4 ms). Cut while the record
+  // is rewritten, it is torn and the previous one is restored, as for a cut
+  // while it was written.
+  sreg = SREG;
+  cli();
+  if (last && pendingEE) {
+    halEepromInterrupt(false);
+    SREG = sreg;
+    while (!halEepromReady()) {
+    }
+    cli();
+    queuedEE = false;
+    targetRecordEEPROM(data);
+    SREG = sreg;
+    return true;
+  }
+
+  // A record being written is never changed in place otherwise: once its last
+  // byte is written it is the newest valid one, and rewriting it would leave a
+  // torn record and the previous one after a power loss. The request waits for
+  // it as the next record, later requests meanwhile replace the queued values.
+  if (pendingEE) {
+    nextEE = data;
+    queuedEE = true;
+  } else {
+    startRecordEEPROM(data);
+  }
+  SREG = sreg;
+
+  return true;
+}
+
+// EEPROM ready: write the next byte which differs from the committed record,
+// then start the queued record or stop when the record is complete
+inline void onEepromReady() {
+  const uint8_t *target = (const uint8_t*) &targetEE;
+  uint8_t *committed = (uint8_t*) &committedEE;
+  uint8_t i;
+
+  while (indexEE < sizeof(persistentData)) {
+    i = indexEE++;
+
+    if (target[i] != committed[i]) {
+      committed[i] = target[i];
+
+      halEepromWrite(offsetEE + i, target[i]);
+      return;
+    }
+  }
+
+  if (queuedEE) {
+    queuedEE = false;
+    startRecordEEPROM(nextEE);
+    return;
+  }
+  pendingEE = false;
+  halEepromInterrupt(false);
+}
+
+void readEEPROMBlock(void *data, uint16_t offset, uint16_t size) {
+  unsigned char sreg;
+
+  // Stop the writer and wait for the byte being written
+  sreg = SREG;
+  cli();
+  halEepromInterrupt(false);
+  SREG = sreg;
+  while (!halEepromReady()) {
+  }
+
+  halEepromRead(data, offset, size);
+
+  sreg = SREG;
+  cli();
+  halEepromInterrupt(pendingEE);
+  SREG = sreg;
+}
+
+void readEEPROM() {
+  persistentData data;
+
+  if (offsetEE + sizeof(data) <= EEPROM_SIZE) {
+    readEEPROMBlock((void*) &data, offsetEE, sizeof(data));
+    bScore.home = toBcd(data.score.home);
+    bScore.away = toBcd(data.score.away);
+    time = data.time;
+  }
+}
+
+void printEEPROM() {
+  persistentData data;
+
+  uint16_t size = sizeof(data);
+
+  uint16_t readCounter = (uint16_t) EEPROM_RECORDS;
+
+  halPrintln("###############################");
+  halPrintln("####### EEPROM CONTENTS #######");
+  halPrint("record count = ");
+  halPrintln(readCounter);
+  halPrint("newest record = ");
+  halPrintln(offsetEE / size);
+  halPrintln();
+
+  for (uint16_t i = 0; i < readCounter; i++) {
+    readEEPROMBlock((void*) &data, size * i, sizeof(data));
+
+    halPrint("Counter = ");
+    halPrint(data.counter);
+    if (data.crc != crcEEPROM(data)) {
+      halPrint(" (invalid)");
+    }
+    halPrintln();
+    halPrint("Score = ");
+    halPrint(data.score.home);
+    halPrint(", ");
+    halPrintln(data.score.away);
+    halPrint("Time = ");
+    halPrint(data.time.min);
+    halPrint(":");
+    halPrint(data.time.sec);
+    halPrint(", ");
+    halPrintln(data.time.period);
+    halPrint("Mode = ");
+    halPrintln(data.mode < SPORT_MODES ? (char) pgm_read_byte(&sportModes[data.mode].key) : '?');
+    halPrint("Sets = ");
+    halPrint(data.vScore[0]);
+    halPrint(", ");
+    halPrint(data.vScore[1]);
+    halPrint(", ");
+    halPrint(data.vSets[0]);
+    halPrint(", ");
+    halPrint(data.vSets[1]);
+    halPrint(", ");
+    halPrintln(data.vSets[2]);
+    halPrintln();
+  }
+}
+
+
+// Horn on time of the countdown channels in "channels" (bit per channel), the
+// longest one: 0 for none
+unsigned long hornLength(uint8_t channels) {
+  unsigned long length = 0;
+
+  for (uint8_t c = 0; c < CD_CHANNELS; c++) {
+    if (channels & _BV(c)) {
+      uint16_t onTime = c == CD_GAME && time.period >= 4 ? BUZZER_ON_END_TIME
+          : pgm_read_word(&hornOnTime[c]);
+
+      length = onTime > length ? onTime : length;
+    }
+  }
+  return length;
+}
+
+// Horn/buzzer management: sound it for "onTime" ms (0 for no new horn). A horn
+// already sounding goes on up to the later end.
+void buzzer(unsigned long onTime) {
+  if (onTime != 0) {
+    if (!buzzerFired) {
+      buzzerOnTime = halMillis();
+      buzzerLength = onTime;
+      halPinWrite(BUZZER_OUTPUT, LOW);
+      buzzerFired = true;
+    } else if (halMillis() - buzzerOnTime + onTime > buzzerLength) {
+      buzzerLength = halMillis() - buzzerOnTime + onTime;
+    }
+  }
+
+  if (buzzerFired && halMillis() - buzzerOnTime > buzzerLength) {
+    buzzerFired = false;
+    halPinWrite(BUZZER_OUTPUT, HIGH);
+  }
+}
+
+
+#ifdef PROFILER
+// #########################################################
+// ##################### Loop profiler #####################
+// #########################################################
+
+void profileReset() {
+  for (uint8_t i = 0; i < PROFILE_PHASES; i++) {
+    memset(&profile[i], 0, sizeof(profile[i]));
+    profile[i].min = 0xFFFF;
+  }
+  profileResetTime = halMicros();
+}
+
+void profileAdd(uint8_t phase, unsigned long duration) {
+  ProfileStat &stat = profile[phase];
+  uint16_t d = duration > 0xFFFF ? 0xFFFF : duration;
+  uint8_t bucket = 0;
+
+  if (d < stat.min) {
+    stat.min = d;
+  }
+  if (d > stat.max) {
+    stat.max = d;
+  }
+  stat.total += d;
+  stat.count++;
+
+  for (uint16_t limit = PROFILE_BUCKET_MIN; d >= limit && bucket < PROFILE_BUCKETS - 1; limit <<= 1) {
+    bucket++;
+  }
+  if (stat.histogram[bucket] < 0xFFFF) {
+    stat.histogram[bucket]++;
+  }
+}
+
+void printProfile() {
+  halPrintln("###############################");
+  halPrintln("######## LOOP PROFILE #########");
+  halPrintln("phase: min avg max (us) | histogram (<8, <16 ... us)");
+
+  for (uint8_t i = 0; i < PROFILE_PHASES; i++) {
+    ProfileStat &stat = profile[i];
+
+    halPrint(profileName[i]);
+    halPrint(": ");
+    if (stat.count == 0) {
+      halPrintln("-");
+      continue;
+    }
+    halPrint(stat.min);
+    halPrint(" ");
+    halPrint(stat.total / stat.count);
+    halPrint(" ");
+    halPrint(stat.max);
+    halPrint(" |");
+    for (uint8_t b = 0; b < PROFILE_BUCKETS; b++) {
+      halPrint(" ");
+      halPrint(stat.histogram[b]);
+    }
+    halPrintln();
+  }
+
+  // Share of the time spent asleep since the last report (up to 71 minutes)
+  halPrint("asleep: ");
+  halPrint(profile[PROFILE_SLEEP].total / ((halMicros() - profileResetTime) / 100 + 1));
+  halPrintln(" %");
+
+  profileReset();
+}
+#endif
+
+#ifdef REMOTE
+// #########################################################
+// ################# Serial remote control #################
+// #########################################################
+
+// One command per line (CR or LF), answered with OK or ERR. The commands act
+// as the control panel buttons do out of setup mode, through the same handlers:
+//   H+1 H+2 H+3 H-   home score +1, +2, +3, -1 (sets sports: H+1 and H-)
+//   A+1 A+2 A+3 A-   away score, as home
+//   H=n A=n          set home/away score
+//   C+ C-            start/stop the clock
+//   C=m:s            set the clock (stopped)
+//   CR               reset the clock (stopped)
+//   K+ K- K=s        start/stop/set the shot clock (runs with the clock)
+//   T+ T- T=s        start/stop/set the timeout
+//   I+ I- I=s        start/stop/set the interval (halftime after period 2)
+//   P+ P=n           next period/set, set period/set
+//   MB MV MH MF MT   basketball, volleyball, handball, futsal, table tennis mode
+//   L=n              display brightness level (1-4)
+//   B                horn
+//   U R              undo, redo the last action (button or command), ERR for a clock
+//                    change with the clock running
+//   E                print the EEPROM contents
+//   D                print the play by play
+//   S                print the loop profile (PROFILER build)
+// The serial RX interrupt and buffer are the Arduino core ones: here the
+// received bytes are parsed as they come, without allocation.
+
+char remoteLine[REMOTE_LINE];
+uint8_t remoteLength = 0;
+boolean remoteOverflow = false;
+
+// Parse a decimal number and move "p" after it
+boolean remoteNumber(const char *&p, uint16_t &value) {
+  uint8_t digits = 0;
+
+  value = 0;
+  while (*p >= '0' && *p <= '9' && digits < 5) {
+    value = value * 10 + (*p++ - '0');
+    digits++;
+  }
+  return digits > 0;
+}
+
+// Score commands for home (H) or away (A)
+boolean remoteScore(const char *cmd, boolean home) {
+  const char *p = cmd + 2;
+  uint16_t value;
+  Score &score = setSport() ? vScore : bScore;
+
+  switch (cmd[1]) {
+    case '+':
+      if (cmd[2] < '1' || cmd[2] > (setSport() ? '1' : '3') || cmd[3] != 0) {
+        return false;
+      }
+      if (home) {
+        handleHomeButtons(HOME_P1 + cmd[2] - '1', false);
+      } else {
+        handleAwayButtons(AWAY_P1 + cmd[2] - '1', false);
+      }
+      return true;
+
+    case '-':
+      if (cmd[2] != 0) {
+        return false;
+      }
+      if (home) {
+        handleHomeButtons(setSport() ? HOME_P2 : HOME_M1, false);
+      } else {
+        handleAwayButtons(setSport() ? AWAY_P2 : AWAY_M1, false);
+      }
+      return true;
+
+    case '=':
+      if (!remoteNumber(p, value) || *p != 0 || value > 9999) {
+        return false;
+      }
+      if (home) {
+        score.home = toBcd(value);
+      } else {
+        score.away = toBcd(value);
+      }
+      saveEEprom = true;
+      updateDisplay = true;
+      return true;
+  }
+  return false;
+}
+
+// Clock commands (sports played on time)
+boolean remoteClock(const char *cmd) {
+  const char *p = cmd + 2;
+  uint16_t min;
+  uint16_t sec;
 
-void resetEEPROM() {
-  persistentData data;
+  if (setSport()) {
+    return false;
+  }
 
-  data.counter = 0;
-  data.score.away = 0;
-  data.score.home = 0;
-  data.time.min = 0;
-  data.time.sec = 0;
-  data.time.period = 0;
+  switch (cmd[1]) {
+    case '+':
+    case '-':
+      if (cmd[2] != 0) {
+        return false;
+      }
+      if (countdown[CD_GAME].running != (cmd[1] == '+')) {
+        handleTimerButtons(TIMER_START_STOP, false);
+      }
+      return countdown[CD_GAME].running == (cmd[1] == '+');
 
-  uint16_t size = sizeof(data);
+    case '=':
+      if (countdown[CD_GAME].running || !remoteNumber(p, min) || *p++ != ':' || !remoteNumber(p, sec)
+          || *p != 0 || min > sport.maxMinutes || sec > 59) {
+        return false;
+      }
+      time.min = min;
+      time.sec = sec;
+      setTimer();
+      updateDisplay = true;
+      return true;
+
+    case 'R':
+      if (countdown[CD_GAME].running || cmd[2] != 0) {
+        return false;
+      }
+      handleTimerButtons(TIMER_RESET, true);
+      return true;
+  }
+  return false;
+}
 
-  uint16_t writeCounter = (uint16_t) EEPROM_SIZE / size;
+// Shot clock, timeout and interval commands: a stopped channel at zero starts
+// from its full length
+boolean remoteCountdown(const char *cmd, uint8_t channel) {
+  const char *p = cmd + 2;
+  uint16_t value;
+
+  switch (cmd[1]) {
+    case '+':
+    case '-':
+      if (cmd[2] != 0) {
+        return false;
+      }
+      if (cmd[1] == '+' && !countdown[channel].running
+          && countdown[channel].sec == 0 && countdown[channel].tenth == 0) {
+        countdownSet(channel, countdownLength(channel));
+      }
+      return countdownRun(channel, cmd[1] == '+');
 
-  for (uint16_t i = 0; i < writeCounter; i++) {
-    eeprom_write_block((void*) &data, (void*) (size * i), sizeof(data));
+    case '=':
+      if (!remoteNumber(p, value) || *p != 0 || value > MAX_MINUTES * 60) {
+        return false;
+      }
+      countdownSet(channel, value);
+      return true;
   }
+  return false;
 }
 
-boolean initializeEEPROM() {
-  persistentData data;
+// Period or set commands
+boolean remotePeriod(const char *cmd) {
+  const char *p = cmd + 2;
+  uint16_t value;
 
-  uint16_t size = sizeof(data);
+  switch (cmd[1]) {
+    case '+':
+      if (cmd[2] != 0) {
+        return false;
+      }
+      handleTimerButtons(PERIOD_P1, false);
+      return true;
+
+    case '=':
+      if (!remoteNumber(p, value) || *p != 0 || value < 1 || value > sport.periods) {
+        return false;
+      }
+      if (setSport()) {
+        vSets.actSet = value;
+        showSetMessage();
+      } else {
+        time.period = value;
+      }
+      saveEEprom = true;
+      updateDisplay = true;
+      return true;
+  }
+  return false;
+}
+
+// Execute one command: false if unknown, malformed or not allowed now
+boolean remoteCommand(const char *cmd) {
+  // The buttons have a different meaning in setup mode
+  if (setupMode && cmd[0] != 'E' && cmd[0] != 'D' && cmd[0] != 'S') {
+    return false;
+  }
 
-  uint16_t readCounter = (uint16_t) EEPROM_SIZE / size;
+  switch (cmd[0]) {
+    case 'H':
+    case 'A':
+      return remoteScore(cmd, cmd[0] == 'H');
 
-  for (uint16_t i = 0; i < readCounter; i++) {
-    eeprom_read_block((void*) &data, (void*) (size * i), sizeof(data));
+    case 'C':
+      return remoteClock(cmd);
+
+    case 'P':
+      return remotePeriod(cmd);
+
+    case 'K':
+      return remoteCountdown(cmd, CD_SHOT);
+
+    case 'T':
+      return remoteCountdown(cmd, CD_TIMEOUT);
+
+    case 'I':
+      return remoteCountdown(cmd, CD_INTERVAL);
+
+    case 'M':
+      if (cmd[2] != 0 || countdown[CD_GAME].running) {
+        return false;
+      }
+      for (uint8_t m = 0; m < SPORT_MODES; m++) {
+        if (pgm_read_byte(&sportModes[m].key) == cmd[1]) {
+          if (sportIndex != m) {
+            setSportMode(m);
+            saveEEprom = true;
+          }
+          return true;
+        }
+      }
+      return false;
+
+    case 'L':
+      if (cmd[1] != '=' || cmd[2] < '1' || cmd[2] > '0' + BRIGHTNESS_LEVELS || cmd[3] != 0) {
+        return false;
+      }
+      brightnessLevel = cmd[2] - '0';
+      brightnessWake();
+      brightnessUpdate(true);
+      return true;
+
+    case 'B':
+      buzzerManCmd = cmd[1] == 0;
+      return buzzerManCmd;
+
+    case 'E':
+      if (cmd[1] != 0) {
+        return false;
+      }
+      printEEPROM();
+      return true;
+
+    case 'U':
+      return cmd[1] == 0 && logUndo();
+
+    case 'R':
+      return cmd[1] == 0 && logRedo();
+
+    case 'D':
+      if (cmd[1] != 0) {
+        return false;
+      }
+      printLog();
+      return true;
 
-    if (data.counter < EEPROM_MAX_WRITE) {
-      if (data.counter == 0 && i > 0) {
-        // Read from previous cell, just reached end of life
-        i--;
-        eeprom_read_block((void*) &data, (void*) (size * i), sizeof(data));
+#ifdef PROFILER
+    case 'S':
+      if (cmd[1] != 0) {
+        return false;
       }
-      counterEE = data.counter;
-      offsetEE = size * i;
-      dataEE = data;
+      printProfile();
       return true;
+#endif
+  }
+  return false;
+}
+
+void remoteControl() {
+  int c;
+
+  while ((c = halSerialRead()) >= 0) {
+    if (c == '\r' || c == '\n') {
+      if (remoteLength > 0) {
+        remoteLine[remoteLength] = 0;
+        logBegin();
+        halPrintln(!remoteOverflow && remoteCommand(remoteLine) ? "OK" : "ERR");
+        logCommit();
+      }
+      remoteLength = 0;
+      remoteOverflow = false;
+    } else if (remoteLength < REMOTE_LINE - 1) {
+      remoteLine[remoteLength++] = c;
+    } else {
+      remoteOverflow = true;
     }
   }
+}
+#endif
 
-  // EEPROM full (end of life), read last saved data
-  dataEE = data;
-  return false;
+#if defined(TELEMETRY) || defined(LINK)
+// #########################################################
+// ##################### Frame encoding ####################
+// #########################################################
+
+// Consistent Overhead Byte Stuffing: returns the encoded size (size + 1)
+uint8_t cobsEncode(const uint8_t *data, uint8_t size, uint8_t *encoded) {
+  uint8_t code = 1;
+  uint8_t codeIndex = 0;
+  uint8_t out = 1;
+
+  for (uint8_t i = 0; i < size; i++) {
+    if (data[i] == 0) {
+      encoded[codeIndex] = code;
+      code = 1;
+      codeIndex = out++;
+    } else {
+      encoded[out++] = data[i];
+      code++;
+    }
+  }
+  encoded[codeIndex] = code;
+
+  return out;
 }
+#endif
 
-boolean writeEEPROM() {
-  persistentData data;
-  uint16_t size = sizeof(data);
+#ifdef TELEMETRY
+// #########################################################
+// ################### Telemetry stream ####################
+// #########################################################
 
-  counterEE++;
+// Every message is sent as a frame: message type and payload, CRC-CCITT of
+// them (little endian), all COBS encoded between two 0 delimiters. Text printed
+// on the serial interface never contains 0, so a receiver drops it as a frame
+// with wrong CRC, and the leading delimiter keeps it out of the next frame.
+
+// State sent in the telemetry messages
+struct TelemetryState {
+  Score score;
+  uint16_t clock;
+  uint8_t running;
+  uint16_t shotClock;
+  uint8_t shotRunning;
+  uint8_t period;
+  Score vScore;
+  uint8_t sets[3];
+  uint8_t buzzer;
+  uint8_t mode;
+};
 
-  if (counterEE > EEPROM_MAX_WRITE) {
-    offsetEE += size;
-    counterEE = 1;
+// Last state queued, compared to find the changes
+TelemetryState telemetrySent;
+unsigned long telemetryKeyframeTime = 0;
+boolean telemetryKeyframe = true;
+
+// TX ring buffer, written and read only by the loop
+uint8_t telemetryBuffer[TELEMETRY_BUFFER];
+uint8_t telemetryHead = 0;
+uint8_t telemetryTail = 0;
+
+// Queue one message as a frame: false if the buffer is full (the message is dropped)
+boolean telemetrySend(const uint8_t *message, uint8_t size) {
+  uint8_t data[TELEMETRY_MAX_MESSAGE + 2];
+  uint8_t frame[TELEMETRY_MAX_FRAME];
+  uint16_t crc = 0xFFFF;
+  uint8_t length;
+  uint8_t free;
+
+  for (uint8_t i = 0; i < size; i++) {
+    data[i] = message[i];
+    crc = _crc_ccitt_update(crc, message[i]);
   }
+  data[size] = crc & 0xFF;
+  data[size + 1] = crc >> 8;
 
-  if (offsetEE >= EEPROM_SIZE) {
+  frame[0] = 0;
+  length = cobsEncode(data, size + 2, frame + 1) + 1;
+  frame[length++] = 0;
+
+  free = (telemetryTail - telemetryHead - 1) & (TELEMETRY_BUFFER - 1);
+  if (free < length) {
     return false;
   }
 
-  data.counter = counterEE;
-  data.score = bScore;
-  data.time = time;
+  for (uint8_t i = 0; i < length; i++) {
+    telemetryBuffer[telemetryHead] = frame[i];
+    telemetryHead = (telemetryHead + 1) & (TELEMETRY_BUFFER - 1);
+  }
+  return true;
+}
+
+// Queue the message if the field changed: the sent copy is updated only when queued
+boolean telemetryField(uint8_t type, const void *value, void *sent, uint8_t size) {
+  uint8_t message[TELEMETRY_MAX_MESSAGE];
+
+  if (!telemetryKeyframe && memcmp(value, sent, size) == 0) {
+    return true;
+  }
 
-  eeprom_write_block((void*) &data, (void*) offsetEE, sizeof(data));
+  message[0] = type;
+  memcpy(message + 1, value, size);
 
+  if (!telemetrySend(message, size + 1)) {
+    return false;
+  }
+  memcpy(sent, value, size);
   return true;
 }
 
-void readEEPROM() {
-  persistentData data;
+void telemetry(uint16_t gameLocal, uint16_t shotLocal) {
+  TelemetryState state;
+  boolean complete;
+  int space;
+
+  state.score.home = fromBcd(bScore.home);
+  state.score.away = fromBcd(bScore.away);
+  state.clock = gameLocal;
+  state.running = countdown[CD_GAME].running;
+  state.shotClock = shotLocal;
+  state.shotRunning = countdown[CD_SHOT].running;
+  state.period = time.period;
+  state.vScore.home = fromBcd(vScore.home);
+  state.vScore.away = fromBcd(vScore.away);
+  state.sets[0] = vSets.actSet;
+  state.sets[1] = vSets.homeSet;
+  state.sets[2] = vSets.awaySet;
+  state.buzzer = buzzerFired;
+  state.mode = sportIndex;
+
+  if (halMillis() - telemetryKeyframeTime > TELEMETRY_KEYFRAME_INT) {
+    telemetryKeyframe = true;
+  }
 
-  if (offsetEE + sizeof(data) <= EEPROM_SIZE) {
-    eeprom_read_block((void*) &data, (void*) offsetEE, sizeof(data));
-    bScore = data.score;
-    time = data.time;
+  // TM_CLOCK and TM_SHOT_CLOCK payloads are time and running, contiguous in TelemetryState
+  complete = telemetryField(TM_MODE, &state.mode, &telemetrySent.mode, sizeof(state.mode))
+      && telemetryField(TM_SCORE, &state.score, &telemetrySent.score, sizeof(state.score))
+      && telemetryField(TM_CLOCK, &state.clock, &telemetrySent.clock,
+          sizeof(state.clock) + sizeof(state.running))
+      && telemetryField(TM_SHOT_CLOCK, &state.shotClock, &telemetrySent.shotClock,
+          sizeof(state.shotClock) + sizeof(state.shotRunning))
+      && telemetryField(TM_PERIOD, &state.period, &telemetrySent.period, sizeof(state.period))
+      && telemetryField(TM_VOLLEY_SCORE, &state.vScore, &telemetrySent.vScore, sizeof(state.vScore))
+      && telemetryField(TM_VOLLEY_SETS, state.sets, telemetrySent.sets, sizeof(state.sets))
+      && telemetryField(TM_BUZZER, &state.buzzer, &telemetrySent.buzzer, sizeof(state.buzzer));
+
+  // The rest of a keyframe is queued in the next passes
+  if (complete && telemetryKeyframe) {
+    telemetryKeyframe = false;
+    telemetryKeyframeTime = halMillis();
+  }
+
+  // Only what fits in the serial TX buffer, halSerialWrite never waits
+  space = halSerialRoom();
+  while (space-- > 0 && telemetryTail != telemetryHead) {
+    halSerialWrite(&telemetryBuffer[telemetryTail], 1);
+    telemetryTail = (telemetryTail + 1) & (TELEMETRY_BUFFER - 1);
   }
 }
+#endif
 
-void printEEPROM() {
-  persistentData data;
+#ifdef LINK
+// #########################################################
+// ################### Serial panel link ###################
+// #########################################################
 
-  uint16_t size = sizeof(data);
+// Control panels and scoreboards share an RS-485 half duplex bus. Every message
+// is a frame as the telemetry ones: destination, source, type, sequence number
+// and payload, CRC-CCITT of them (little endian), COBS encoded between two 0
+// delimiters. A panel sends a button frame and waits for the LK_ACK of its
+// sequence number, sending it again (same number) after a random backoff when
+// the ack does not come: the board executes a sequence number once, and
+// acknowledges the repeated ones too. Idle panels send LK_HEARTBEAT, and a panel
+// silent for LINK_TIMEOUT ms is disconnected. Broadcast frames are executed by
+// all the boards and never acknowledged. The frames addressed to other boards,
+// or with a wrong CRC (collisions), are dropped.
+// The analog ladders stay in use: the link is one more input. The host tool
+// Tools/link_panel.cpp stands in for a panel, the simulator of a LINK host build
+// on a pty (scoreboard_sim -p) for a board.
+
+// Panel seen on the bus: address 0 for a free entry
+struct LinkPanel {
+  uint8_t address;
+  uint8_t seq;
+  boolean seqValid;
+  unsigned long seen;
+};
 
-  uint16_t readCounter = (uint16_t) EEPROM_SIZE / size;
+LinkPanel linkPanels[LINK_PANELS];
+boolean linkConnected = false;
 
-  Serial.println("###############################");
-  Serial.println("####### EEPROM CONTENTS #######");
-  Serial.print("record count = ");
-  Serial.println(readCounter);
-  Serial.println();
+// Received frame, until the next delimiter
+uint8_t linkFrame[LINK_MAX_FRAME];
+uint8_t linkLength = 0;
+boolean linkOverflow = false;
 
-  for (uint16_t i = 0; i < readCounter; i++) {
-    eeprom_read_block((void*) &data, (void*) (size * i), sizeof(data));
+// Acknowledge waiting for the bus (destination 0 for none), and transceiver
+// driver enabled until the transmit complete interrupt
+uint8_t linkAckDestination = 0;
+uint8_t linkAckSeq;
+volatile boolean linkDriverOn = false;
+
+// Decode a COBS block: returns the decoded size, 0 if the encoding is wrong
+uint8_t cobsDecode(const uint8_t *encoded, uint8_t size, uint8_t *data) {
+  uint8_t in = 0;
+  uint8_t out = 0;
+
+  while (in < size) {
+    uint8_t code = encoded[in++];
 
-    Serial.print("Counter = ");
-    Serial.println(data.counter);
-    Serial.print("Score = ");
-    Serial.print(data.score.home);
-    Serial.print(", ");
-    Serial.println(data.score.away);
-    Serial.print("Time = ");
-    Serial.print(data.time.min);
-    Serial.print(":");
-    Serial.print(data.time.sec);
-    Serial.print(", ");
-    Serial.println(data.time.period);
-    Serial.println();
+    if (code == 0 || in + code - 1 > size) {
+      return 0;
+    }
+    for (uint8_t i = 1; i < code; i++) {
+      data[out++] = encoded[in++];
+    }
+    if (in < size) {
+      data[out++] = 0;
+    }
+  }
+  return out;
+}
+
+// Send one frame with the driver enabled, the bus free: the transmit complete
+// interrupt releases it after the last stop bit. A text byte still shifting
+// out from the TX buffer (printed with the driver off) reaches the bus as a
+// broken frame, ended by the delimiter starting this one.
+void linkSend(uint8_t destination, uint8_t type, uint8_t seq) {
+  uint8_t data[LINK_HEADER + 2];
+  uint8_t frame[LINK_MAX_FRAME];
+  uint16_t crc = 0xFFFF;
+  uint8_t length;
+
+  data[0] = destination;
+  data[1] = LINK_ADDRESS;
+  data[2] = type;
+  data[3] = seq;
+  for (uint8_t i = 0; i < LINK_HEADER; i++) {
+    crc = _crc_ccitt_update(crc, data[i]);
   }
+  data[LINK_HEADER] = crc & 0xFF;
+  data[LINK_HEADER + 1] = crc >> 8;
+
+  frame[0] = 0;
+  length = cobsEncode(data, LINK_HEADER + 2, frame + 1) + 1;
+  frame[length++] = 0;
+
+  linkDriverOn = true;
+  halPinWrite(PIN_LINK_DRIVER, HIGH);
+  halSerialWrite(frame, length);
+  halSerialTxInterrupt(true);
 }
 
+inline void onSerialTxComplete() {
+  halSerialTxInterrupt(false);
+  halPinWrite(PIN_LINK_DRIVER, LOW);
+  linkDriverOn = false;
+}
+
+// The bus is free for the acknowledge waiting
+boolean linkAckReady() {
+  return linkAckDestination != 0 && !linkDriverOn && halSerialTxEmpty();
+}
+
+// Entry of the panel "address", taken from the free ones for a new panel:
+// NULL if the table is full (the panel is ignored until one disconnects)
+LinkPanel *linkPanel(uint8_t address) {
+  LinkPanel *free = NULL;
 
-// Horn/buzzer management
-void buzzer(boolean activation) {
-  unsigned long buzzerTime;
+  for (uint8_t i = 0; i < LINK_PANELS; i++) {
+    if (linkPanels[i].address == address) {
+      return &linkPanels[i];
+    }
+    if (linkPanels[i].address == 0 && free == NULL) {
+      free = &linkPanels[i];
+    }
+  }
+  if (free != NULL) {
+    free->address = address;
+    free->seqValid = false;
+  }
+  return free;
+}
 
-  if (time.period >= 4) {
-    buzzerTime = BUZZER_ON_END_TIME;
+// Execute the button of a frame through the handler of its ladder: false for
+// a wrong button, before any action
+boolean linkButton(uint8_t id, uint8_t held) {
+  if (held > 1) {
+    return false;
+  }
+  if (id >= HOME_P1 && id <= HOME_M1) {
+    handleHomeButtons(id, held);
+  } else if (id >= AWAY_P1 && id <= AWAY_M1) {
+    handleAwayButtons(id, held);
+  } else if (id >= TIMER_START_STOP && id <= SETUP_MODE) {
+    handleTimerButtons(id, held);
   } else {
-    buzzerTime = BUZZER_ON_TIME;
+    return false;
   }
+  return true;
+}
 
-  if (activation) {
-    if (!buzzerFired) {
-      buzzerOnTime = millis();
-      digitalWrite(BUZZER_OUTPUT, LOW);
-      buzzerFired = true;
-    }
+// Check and execute a decoded frame
+void linkReceive(const uint8_t *data, uint8_t size) {
+  uint16_t crc = 0xFFFF;
+  uint8_t destination;
+  uint8_t source;
+  uint8_t seq;
+  LinkPanel *panel;
+
+  if (size < LINK_HEADER + 2) {
+    return;
+  }
+  for (uint8_t i = 0; i < size; i++) {
+    crc = _crc_ccitt_update(crc, data[i]);
   }
+  destination = data[0];
+  source = data[1];
+  seq = data[3];
+  // The CRC of data and CRC (little endian) is 0
+  if (crc != 0 || (destination != LINK_ADDRESS && destination != LINK_BROADCAST)
+      || source == 0 || source == LINK_BROADCAST) {
+    return;
+  }
+  size -= LINK_HEADER + 2;
 
-  if (buzzerFired && millis() - buzzerOnTime > buzzerTime) {
-    buzzerFired = false;
-    digitalWrite(BUZZER_OUTPUT, HIGH);
+  panel = linkPanel(source);
+  if (panel == NULL) {
+    return;
+  }
+  panel->seen = halMillis();
+  linkConnected = true;
+
+  switch (data[2]) {
+    case LK_BUTTON:
+      if (size != 2) {
+        return;
+      }
+      if (!panel->seqValid || panel->seq != seq) {
+        if (!linkButton(data[LINK_HEADER], data[LINK_HEADER + 1])) {
+          return;
+        }
+        panel->seq = seq;
+        panel->seqValid = true;
+      }
+      break;
+
+    case LK_HEARTBEAT:
+      break;
+
+    default:
+      return;
+  }
+
+  // Sent by linkControl: a newer frame takes the place of the one waiting, its
+  // panel sends that again
+  if (destination != LINK_BROADCAST) {
+    linkAckDestination = source;
+    linkAckSeq = seq;
   }
 }
 
+void linkControl() {
+  uint8_t data[LINK_MAX_FRAME];
+  boolean connected = false;
+  int c;
+
+  while ((c = halSerialRead()) >= 0) {
+    if (c == 0) {
+      if (linkLength > 0 && !linkOverflow) {
+        uint8_t size = cobsDecode(linkFrame, linkLength, data);
+
+        if (size > 0) {
+          linkReceive(data, size);
+        }
+      }
+      linkLength = 0;
+      linkOverflow = false;
+    } else if (linkLength < LINK_MAX_FRAME) {
+      linkFrame[linkLength++] = c;
+    } else {
+      linkOverflow = true;
+    }
+  }
+
+  if (linkAckReady()) {
+    linkSend(linkAckDestination, LK_ACK, linkAckSeq);
+    linkAckDestination = 0;
+  }
+
+  for (uint8_t i = 0; i < LINK_PANELS; i++) {
+    if (linkPanels[i].address != 0) {
+      if (halMillis() - linkPanels[i].seen > LINK_TIMEOUT) {
+        linkPanels[i].address = 0;
+      } else {
+        connected = true;
+      }
+    }
+  }
+
+  // The last panel lost: the buttons on the ladders still work
+  if (linkConnected && !connected) {
+    showMessage(0, PSTR("PAnEL Err"), MESSAGE_LINK_ERROR_TIME);
+  }
+  linkConnected = connected;
+}
+#endif
 
 // ========================================================
 // |                        SETUP                         |
 // ========================================================
 
-void setupDiplay() {
-#ifdef PROTOTYPE
-    // Prototype breadboard display
-    disManager.addGroup(0, 2, &time.min);
-    disManager.addGroup(1, 2, &time.sec);
-    disManager.addGroup(2, 1, &time.period);
-    disManager.addGroup(3, 2, &bScore.home);
-    disManager.addGroup(4, 2, &bScore.away);
-#else
-    // Big display
-    disManager.addGroup(0, 2, &bScore.home, gDigits7, sizeof(gDigits7));
-    disManager.addGroup(1, 2, &bScore.away, gDigits7, sizeof(gDigits7));
-    disManager.addGroup(2, 1, &time.period, gDigits7, sizeof(gDigits7));
-    disManager.addGroup(3, 2, &time.min, gDigits4, sizeof(gDigits4));
-    disManager.addGroup(4, 2, &time.sec, gDigits4, sizeof(gDigits4));
-#endif
-}
-
 void setup() {
-  pinMode(BUZZER_OUTPUT, OUTPUT);
+  halPinOutput(BUZZER_OUTPUT);
 
-  digitalWrite(BUZZER_OUTPUT, HIGH);
+  halPinWrite(BUZZER_OUTPUT, HIGH);
 
-  Serial.begin(115200);
+  halSerialBegin(115200);
 
-  // Display manager setup
-  setupDiplay();
-
-  // Input Buttons
-  homeButtons.addButton(b1);
-  homeButtons.addButton(b2);
-  homeButtons.addButton(b3);
-  homeButtons.addButton(b4);
-
-  awayButtons.addButton(b5);
-  awayButtons.addButton(b6);
-  awayButtons.addButton(b7);
-  awayButtons.addButton(b8);
-
-  timerButtons.addButton(b9);
-  timerButtons.addButton(b10);
-  timerButtons.addButton(b11);
-  timerButtons.addButton(b12);
-
-  // Variable initialization
-  bScore.home = 0;
-  bScore.away = 0;
-
-  time.period = 1;
-  time.min = TIMER_INIT_MIN;
-  time.sec = TIMER_INIT_SEC;
-  sec = TIMER_INIT_MIN * 60 + TIMER_INIT_SEC;
-
-  vScore.home = 0;
-  vScore.away = 0;
-
-  vSets.actSet = 1;
-  vSets.homeSet = 0;
-  vSets.awaySet = 0;
-
-  timerRunning = false;
-
-  // Setup of timer1 CTC interrupt
-  // Initialize Timer1
-  cli();          // disable global interrupts
-  TCCR1A = 0;     // set entire TCCR1A register to 0
-  TCCR1B = 0;     // same for TCCR1B
-
-  // Set compare match register to desired timer count
-  OCR1A = 15624;
-  // Turn on CTC mode
-  // TCCR1B |= (1 << WGM12);
-  // Set CS10 and CS12 bits for 1024 prescaler
-  // TCCR1B |= (1 << CS10);
-  // TCCR1B |= (1 << CS12);
-  // TCCR1B = 13;
-
-  // Enable timer compare interrupt:
-  TIMSK1 |= _BV(OCIE1A);
-  TCNT1 = 0;                // reset counter
-  TIFR1 |= _BV(OCF1A);      // clear interrupt flag
-  sei();                    // Enable global interrupts
+#ifdef LINK
+  // Receiver enabled, driver off the bus
+  halPinOutput(PIN_LINK_DRIVER);
+  halPinWrite(PIN_LINK_DRIVER, LOW);
+#endif
 
-  disManager.updateAll();
+  // Display manager setup
+#ifdef DISPLAY_PARALLEL
+  disManager.attach(&mirrorChain);
+  disManager.attach(&panelChain);
+#endif
+  disManager.begin();
 
+  // Last sport, score, clock and period, and score and sets of the sets sports,
+  // from the EEPROM journal: the first frame shows the game as it was before a
+  // power loss. The sport first, its clock direction tells how to load the time
+  // saved.
   counterEE = 0;
   offsetEE = EEPROM_SIZE;
 
   endOfLifeEE = !initializeEEPROM();
+  setSportMode(dataEE.mode < SPORT_MODES ? dataEE.mode : SPORT_BASKETBALL);
+  brightnessUpdate(false);
+  actReload();
+
+  vScore.home = toBcd(dataEE.vScore[0]);
+  vScore.away = toBcd(dataEE.vScore[1]);
+  vSets.actSet = dataEE.vSets[0];
+  vSets.homeSet = dataEE.vSets[1];
+  vSets.awaySet = dataEE.vSets[2];
+
+  // Timer1 not running yet: the countdowns as loaded
+  displayValues((const Countdown*) countdown);
+  disManager.updateAll();
+
+#ifdef BENCHMARK
+  bootFrameTime = halMicros();
+#endif
+
+  // Analog inputs sampled in background
+  configureADC();
+
+#ifdef POWER_SENSE
+  halPowerSenseInit();
+#endif
+
+  // Setup of timer1 CTC interrupt, always running: the countdown channels are
+  // started and stopped by the tick handler
+  halTimer1Init(TIMER1_TOP);
+  halTimer1Run(true);
+  sei();                    // Enable global interrupts
 
+#ifdef BENCHMARK
+  benchmarkDisplay();
+  benchmarkClockDigits();
+#endif
+
+#ifdef PROFILER
+  profileReset();
+#endif
+
+  // Diagnostics are shown by the loop, that starts at once
   if (endOfLifeEE) {
-    for (int i = 0; i < 20; ++i) {
-      digitalWrite(PIN_OUTPUT_ENABLE, (i % 2 == 0));
-      delay(500);
-    }
+    showMessage(0, PSTR("EE Err"), MESSAGE_EE_ERROR_TIME);
   }
 } // End of setup
 
@@ -845,53 +4068,197 @@ void setup() {
 // |                        LOOP                          |
 // ========================================================
 
+// Serial work for the loop: received bytes, telemetry bytes waiting for room
+// in the TX buffer (that frees up in the TX interrupt), a link acknowledge
+// waiting for the bus (freed by the transmit complete interrupt)
+boolean serialPending() {
+#ifdef TELEMETRY
+  if (telemetryHead != telemetryTail && halSerialRoom() > 0) {
+    return true;
+  }
+#endif
+#ifdef LINK
+  if (linkAckReady()) {
+    return true;
+  }
+#endif
+#if defined(REMOTE) || defined(PROFILER) || defined(LINK)
+  return halSerialAvailable() > 0;
+#else
+  return false;
+#endif
+}
+
 void loop() {
   boolean updateDisplayLocal = true;
   boolean saveEEpromLocal = false;
-  unsigned long secLocal;
+  Countdown countdownLocal[CD_CHANNELS];
+  boolean countdownRunning = false;
+  uint8_t hornLocal = 0;
   unsigned char sreg;
+  uint16_t adcValue[ADC_INPUTS];
+  uint8_t eventsLocal;
+
+  // Wait for an event in idle sleep. Every interrupt wakes the CPU up (also the
+  // millis timer), but the loop runs only for an event or for work requested
+  // by the loop itself and the serial interface.
+  cli();
+  while (events == 0 && !updateDisplay && !saveEEprom && !buzzerManCmd && !serialPending()) {
+    PROFILE_START();
+    halSleep();
+    cli();
+    PROFILE_END(PROFILE_SLEEP);
+  }
+  sei();
+
+  PROFILE_START_LOOP();
+
+#ifdef PROFILER
+#ifndef REMOTE
+  // Report request from the serial interface
+  if (halSerialAvailable() > 0 && halSerialRead() == 'P') {
+    printProfile();
+  }
+#endif
+#endif
+
+  PROFILE_START();
 
   // Interrupt free context to update shared volatile variables
   sreg = SREG;
   cli();
+  eventsLocal = events;
+  events = 0;
   updateDisplayLocal = updateDisplay;
   saveEEpromLocal = saveEEprom;
   updateDisplay = false;
   saveEEprom = false;
-  secLocal = sec;
+  for (uint8_t c = 0; c < CD_CHANNELS; c++) {
+    countdownLocal[c].sec = countdown[c].sec;
+    countdownLocal[c].tenth = countdown[c].tenth;
+    countdownLocal[c].clock = countdown[c].clock;
+    countdownLocal[c].running = countdown[c].running;
+    countdownRunning |= countdown[c].running;
+    if (countdown[c].expired) {
+      hornLocal |= _BV(c);
+    }
+    countdown[c].expired = false;
+  }
+  adcValue[ADC_HOME] = adcSample[ADC_HOME];
+  adcValue[ADC_AWAY] = adcSample[ADC_AWAY];
+  adcValue[ADC_TIMER] = adcSample[ADC_TIMER];
   sei();
   SREG = sreg;
 
-  // Buzzer management
-  buzzer((secLocal == 0 && timerRunning) || buzzerManCmd);
-  buzzerManCmd = false;
+  PROFILE_END(PROFILE_SNAPSHOT);
 
-  if (secLocal == 0) {
-    START_STOP_TIMER(sreg, 0);
-    timerRunning = false;
+#ifdef POWER_SENSE
+  // Power failing: the last record first, then nothing else until the supply is
+  // back (a brown-out reset ends it otherwise)
+  if (eventsLocal & EVENT_POWER) {
+    time.min = fromBcd(countdownLocal[CD_GAME].clock >> 8);
+    time.sec = fromBcd(countdownLocal[CD_GAME].clock & 0xFF);
+    endOfLifeEE = !writeEEPROM(true);
+    powerFail = true;
+  }
+  if (powerFail) {
+    cli();
+    if (halPowerGood()) {
+      powerDown = false;
+    }
+    sei();
+    if (powerDown) {
+      PROFILE_END_LOOP();
+      return;
+    }
+    // Display enabled again by the next frame
+    powerFail = false;
+    updateDisplayLocal = true;
   }
+#endif
 
-  // Fix for wrong value displayed when idle: refresh display when idle, not more than
-  // every UPDATE_DISPLAY_INT ms
-  if (!updateDisplayLocal and !timerRunning and millis() - upDisplayTime > UPDATE_DISPLAY_INT) {
-    disManager.updateAll();
-    upDisplayTime = millis();
+#ifdef PROFILER
+  if (profileTick) {
+    profileAdd(PROFILE_TICK, halMicros() - profileTickTime);
+    profileTick = false;
+  }
+#endif
+
+  // Buzzer management: a horn for every channel reaching zero, switched off on a tick
+  if ((eventsLocal & EVENT_TICK) || hornLocal || buzzerManCmd) {
+    PROFILE_START();
+    buzzer(buzzerManCmd ? BUZZER_ON_TIME : hornLength(hornLocal));
+    buzzerManCmd = false;
+    PROFILE_END(PROFILE_BUZZER);
+  }
+
+  // Dimmed while idle, back at the operator level with a running countdown (or
+  // on a button, see brightnessWake)
+  if (eventsLocal & EVENT_TICK) {
+    if (countdownRunning) {
+      activityTime = halMillis();
+    }
+    if (brightnessDimmed != (halMillis() - activityTime > IDLE_DIM_TIME)) {
+      brightnessDimmed = !brightnessDimmed;
+      brightnessUpdate(true);
+    }
+  }
+
+  // Timed message expired
+  if ((eventsLocal & EVENT_TICK) && messageDuration != 0
+      && halMillis() - messageTime >= messageDuration) {
+    messageDuration = 0;
+    updateDisplayLocal = true;
+  }
+
+  // Integrity refresh when idle, against noise on the chain: the last frame sent
+  // again, not more than every UPDATE_DISPLAY_INT ms
+  if ((eventsLocal & EVENT_TICK) and !updateDisplayLocal and !countdownRunning
+      and halMillis() - upDisplayTime > UPDATE_DISPLAY_INT) {
+    PROFILE_START();
+    disManager.refresh();
+    PROFILE_END(PROFILE_DISPLAY);
+    upDisplayTime = halMillis();
   }
 
   // Update display on request and reset request bit
   if (updateDisplayLocal) {
 
-    time.min = secLocal / 60;
-    time.sec = secLocal % 60;
+    // Game time shown: the elapsed one for a clock counting up
+    time.min = fromBcd(countdownLocal[CD_GAME].clock >> 8);
+    time.sec = fromBcd(countdownLocal[CD_GAME].clock & 0xFF);
+
+    displayValues(countdownLocal);
 
     // Updates all the register display in reverse order for every group
+    PROFILE_START();
     disManager.updateAll();
+    PROFILE_END(PROFILE_DISPLAY);
     updateDisplayLocal = false;
   }
 
+  // Frame encoded while the SPI was busy
+  if (eventsLocal & EVENT_FRAME) {
+    disManager.service();
+  }
+
+#ifdef REMOTE
+  remoteControl();
+#endif
+
+#ifdef TELEMETRY
+  telemetry(time.min * 60 + time.sec, countdownLocal[CD_SHOT].sec);
+#endif
+
+#ifdef LINK
+  linkControl();
+#endif
+
   // Save score and time in EEPROM
   if (saveEEpromLocal) {
-    endOfLifeEE = !writeEEPROM();
+    PROFILE_START();
+    endOfLifeEE = !writeEEPROM(false);
+    PROFILE_END(PROFILE_EEPROM);
     saveEEpromLocal = false;
   }
 
@@ -900,50 +4267,53 @@ void loop() {
   inputEnable = true;
 #endif
 
+  // Analog inputs are checked once for every new sample of all the inputs while
+  // a button is in use (or an input is off the released level)
+  if (!(eventsLocal & EVENT_INPUT)) {
+    PROFILE_END_LOOP();
+    return;
+  }
+
+  PROFILE_START();
 
   // Analog input not connected
   if (!inputEnable) {
-    int homeAnalogValue = analogRead(HOME_ANALOG_INPUT);
-    // Delay before the next analogRead, for the analog-to-digital converter
-    // to settle after the last reading
-    delay(10);
-    int awayAnalogValue = analogRead(AWAY_ANALOG_INPUT);
-    delay(10);
-    int timerAnalogValue = analogRead(TIMER_ANALOG_INPUT);
-    delay(4);
 
     // This check works only if the analog input are kept low with a pull down
     // resistor!
-    if (homeAnalogValue <= MIN_VALID_ANALOG_VALUE
-        && awayAnalogValue <= MIN_VALID_ANALOG_VALUE
-        && timerAnalogValue <= MIN_VALID_ANALOG_VALUE) {
+    if (adcValue[ADC_HOME] <= MIN_VALID_ANALOG_VALUE
+        && adcValue[ADC_AWAY] <= MIN_VALID_ANALOG_VALUE
+        && adcValue[ADC_TIMER] <= MIN_VALID_ANALOG_VALUE) {
       inputEnable = true;
     }
   } else {
     // Analog input connected, check for buttons pressed
-    int homeAnalogValue = analogRead(HOME_ANALOG_INPUT);
-    int awayAnalogValue = analogRead(AWAY_ANALOG_INPUT);
-    int timerAnalogValue = analogRead(TIMER_ANALOG_INPUT);
+    unsigned long now = halMillis();
 
-    homeButtons.checkValue(homeAnalogValue);
-    awayButtons.checkValue(awayAnalogValue);
-    timerButtons.checkValue(timerAnalogValue);
+    ladderUpdate(homeLadder, adcValue[ADC_HOME], now);
+    ladderUpdate(awayLadder, adcValue[ADC_AWAY], now);
+    ladderUpdate(timerLadder, adcValue[ADC_TIMER], now);
+    inputIdle = ladderIdle(homeLadder) && ladderIdle(awayLadder) && ladderIdle(timerLadder);
 
 #ifdef DEBUG
-  Serial.print("ANALOG V = ");
-  Serial.print(homeAnalogValue);
-  Serial.print(" ");
-  Serial.print(awayAnalogValue);
-  Serial.print(" ");
-  Serial.println(timerAnalogValue);
+  halPrint("ANALOG V = ");
+  halPrint(adcValue[ADC_HOME]);
+  halPrint(" ");
+  halPrint(adcValue[ADC_AWAY]);
+  halPrint(" ");
+  halPrintln(adcValue[ADC_TIMER]);
 #endif
 
     // The analog inputs have been disconnected: "random" value will be on
     // each analog port (usually much greater than 0)
-    if (homeAnalogValue > MIN_VALID_ANALOG_VALUE
-        && awayAnalogValue > MIN_VALID_ANALOG_VALUE
-        && timerAnalogValue > MIN_VALID_ANALOG_VALUE) {
+    if (adcValue[ADC_HOME] > MIN_VALID_ANALOG_VALUE
+        && adcValue[ADC_AWAY] > MIN_VALID_ANALOG_VALUE
+        && adcValue[ADC_TIMER] > MIN_VALID_ANALOG_VALUE) {
       inputEnable = false;
+      inputIdle = false;
     }
   }
+
+  PROFILE_END(PROFILE_INPUT);
+  PROFILE_END_LOOP();
 } // End of loop
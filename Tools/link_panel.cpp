@@ -0,0 +1,403 @@
+/*
+ *  This file is part of ScoreBoard project.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * ScoreBoard serial panel link (host tool).
+ *
+ * Stands in for a control panel on the RS-485 bus of a LINK build: one button
+ * per line of standard input, sent as an LK_BUTTON frame and repeated after a
+ * random backoff until acknowledged (RETRIES times at most), and a heartbeat
+ * every HEARTBEAT_INT ms while idle. The board is lost after LINK_TIMEOUT ms
+ * without acknowledges. The frame format and message types must match the
+ * "Serial panel link" section of main.cpp.
+ *
+ * Input: "id" or "id h" (held), button IDs as in main.cpp (1-12); "wait ms"
+ * pauses the input, "quiet ms" the heartbeats too (the board disconnects the
+ * panel); "#" starts a comment. The tool ends with the input.
+ *
+ * The bus adapter must switch its driver by itself, as the USB RS-485 adapters
+ * with automatic direction control do. Without a board, the game simulator of a
+ * LINK host build is one on a pty, running the firmware receive path:
+ *   make host DEFINES=-DLINK && ./scoreboard_sim -p
+ *   link_panel /dev/pts/N
+ *
+ * Build: g++ -O2 -o link_panel link_panel.cpp
+ * Usage: link_panel [-a address] [-b board] device
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+// Link addresses, times (ms) and frame, as in main.cpp
+#define LINK_ADDRESS            0x01
+#define LINK_BROADCAST          0xFF
+#define LINK_TIMEOUT            1000
+#define LINK_HEADER             4
+#define LINK_MAX_MESSAGE        (LINK_HEADER + 2)
+#define LINK_MAX_FRAME          (LINK_MAX_MESSAGE + 5)
+
+// Link message types
+#define LK_BUTTON               1
+#define LK_HEARTBEAT            2
+#define LK_ACK                  3
+
+// Panel side: default address, heartbeat interval, acknowledge timeout and
+// maximum random backoff (ms), sends of a button frame
+#define PANEL_ADDRESS           0x10
+#define HEARTBEAT_INT           250
+#define ACK_TIMEOUT             20
+#define BACKOFF_MAX             30
+#define RETRIES                 5
+
+#define POLL_INT                10
+
+// Button IDs, as in main.cpp
+#define BUTTON_FIRST            1
+#define BUTTON_LAST             12
+
+// Frame being received, until the next delimiter
+struct Receiver {
+  uint8_t frame[LINK_MAX_FRAME];
+  int length;
+  bool overflow;
+};
+
+struct Panel {
+  int fd;
+  uint8_t address;
+  uint8_t board;
+  Receiver rx;
+  uint8_t seq;
+  uint8_t button[2];
+  bool waiting;
+  int sends;
+  unsigned long deadline;
+  unsigned long lastSend;
+  unsigned long lastAck;
+  unsigned long pauseUntil;
+  unsigned long quietUntil;
+  bool connected;
+};
+
+static unsigned long now() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000UL + ts.tv_nsec / 1000000;
+}
+
+static uint16_t crcCcittUpdate(uint16_t crc, uint8_t data) {
+  data ^= crc & 0xFF;
+  data ^= data << 4;
+  return ((((uint16_t) data << 8) | (crc >> 8)) ^ (uint8_t) (data >> 4) ^ ((uint16_t) data << 3));
+}
+
+// Consistent Overhead Byte Stuffing: returns the encoded size (size + 1)
+static int cobsEncode(const uint8_t *data, int size, uint8_t *encoded) {
+  int code = 1;
+  int codeIndex = 0;
+  int out = 1;
+
+  for (int i = 0; i < size; i++) {
+    if (data[i] == 0) {
+      encoded[codeIndex] = code;
+      code = 1;
+      codeIndex = out++;
+    } else {
+      encoded[out++] = data[i];
+      code++;
+    }
+  }
+  encoded[codeIndex] = code;
+  return out;
+}
+
+// Decode a COBS frame (delimiter excluded): returns the decoded size, -1 if malformed
+static int cobsDecode(const uint8_t *encoded, int size, uint8_t *data) {
+  int in = 0;
+  int out = 0;
+
+  while (in < size) {
+    int code = encoded[in++];
+
+    if (code == 0 || in + code - 1 > size) {
+      return -1;
+    }
+    for (int i = 1; i < code; i++) {
+      data[out++] = encoded[in++];
+    }
+    if (code < 0xFF && in < size) {
+      data[out++] = 0;
+    }
+  }
+  return out;
+}
+
+static bool configure(int fd) {
+  struct termios tio;
+
+  if (tcgetattr(fd, &tio) != 0) {
+    return false;
+  }
+  cfmakeraw(&tio);
+  cfsetispeed(&tio, B115200);
+  cfsetospeed(&tio, B115200);
+  tio.c_cc[VMIN] = 0;
+  tio.c_cc[VTIME] = 0;
+  return tcsetattr(fd, TCSANOW, &tio) == 0;
+}
+
+static void send(int fd, uint8_t destination, uint8_t source, uint8_t type, uint8_t seq,
+    const uint8_t *payload, int size) {
+  uint8_t data[LINK_MAX_MESSAGE];
+  uint8_t frame[LINK_MAX_FRAME];
+  uint16_t crc = 0xFFFF;
+  int length;
+
+  data[0] = destination;
+  data[1] = source;
+  data[2] = type;
+  data[3] = seq;
+  memcpy(data + LINK_HEADER, payload, size);
+  size += LINK_HEADER;
+  for (int i = 0; i < size; i++) {
+    crc = crcCcittUpdate(crc, data[i]);
+  }
+  data[size++] = crc & 0xFF;
+  data[size++] = crc >> 8;
+
+  frame[0] = 0;
+  length = cobsEncode(data, size, frame + 1) + 1;
+  frame[length++] = 0;
+  if (write(fd, frame, length) != length) {
+    perror("write");
+  }
+}
+
+// Add a received byte: at the end of a frame with the right CRC, returns the
+// message size (CRC excluded) in "data", else 0
+static int receive(Receiver &rx, uint8_t c, uint8_t *data) {
+  int size = -1;
+  uint16_t crc = 0xFFFF;
+
+  if (c != 0) {
+    if (rx.length < LINK_MAX_FRAME) {
+      rx.frame[rx.length++] = c;
+    } else {
+      rx.overflow = true;
+    }
+    return 0;
+  }
+  if (rx.length > 0 && !rx.overflow) {
+    size = cobsDecode(rx.frame, rx.length, data);
+  }
+  rx.length = 0;
+  rx.overflow = false;
+  if (size < LINK_HEADER + 2) {
+    return 0;
+  }
+  for (int i = 0; i < size; i++) {
+    crc = crcCcittUpdate(crc, data[i]);
+  }
+  return crc == 0 ? size - 2 : 0;
+}
+
+static void panelSend(Panel &panel) {
+  panel.sends++;
+  panel.lastSend = now();
+  panel.deadline = panel.lastSend + ACK_TIMEOUT + rand() % (BACKOFF_MAX + 1);
+  send(panel.fd, panel.board, panel.address, LK_BUTTON, panel.seq, panel.button, 2);
+}
+
+// Execute an input line
+static void panelLine(Panel &panel, const char *line) {
+  unsigned id;
+  char held[8];
+  int fields;
+
+  if (line[0] == '#' || line[0] == '\n') {
+    return;
+  }
+  if (sscanf(line, "wait %u", &id) == 1) {
+    panel.pauseUntil = now() + id;
+    return;
+  }
+  if (sscanf(line, "quiet %u", &id) == 1) {
+    panel.pauseUntil = now() + id;
+    panel.quietUntil = panel.pauseUntil;
+    return;
+  }
+  fields = sscanf(line, "%u %7s", &id, held);
+  if (fields < 1 || id < BUTTON_FIRST || id > BUTTON_LAST || (fields == 2 && strcmp(held, "h") != 0)) {
+    fprintf(stderr, "bad line: %s", line);
+    return;
+  }
+  panel.seq++;
+  panel.button[0] = id;
+  panel.button[1] = fields == 2;
+  panel.waiting = true;
+  panel.sends = 0;
+  panelSend(panel);
+}
+
+static void panelReceive(Panel &panel, const uint8_t *data, int size) {
+  if (data[0] != panel.address || data[1] != panel.board || data[2] != LK_ACK || size != LINK_HEADER) {
+    return;
+  }
+  panel.lastAck = now();
+  if (!panel.connected) {
+    printf("panel: board %02X connected\n", panel.board);
+    panel.connected = true;
+  }
+  if (panel.waiting && data[3] == panel.seq) {
+    printf("panel: button %u seq %u acknowledged (%d sends)\n", panel.button[0], panel.seq, panel.sends);
+    panel.waiting = false;
+  }
+}
+
+static void panelCheck(Panel &panel) {
+  unsigned long t = now();
+
+  if (panel.waiting && t >= panel.deadline) {
+    if (panel.sends < RETRIES) {
+      panelSend(panel);
+    } else {
+      printf("panel: button %u seq %u not acknowledged\n", panel.button[0], panel.seq);
+      panel.waiting = false;
+    }
+  }
+  if (!panel.waiting && t >= panel.quietUntil && t - panel.lastSend >= HEARTBEAT_INT) {
+    panel.lastSend = t;
+    send(panel.fd, panel.board, panel.address, LK_HEARTBEAT, panel.seq, NULL, 0);
+  }
+  if (panel.connected && t - panel.lastAck > LINK_TIMEOUT) {
+    printf("panel: board %02X lost\n", panel.board);
+    panel.connected = false;
+  }
+}
+
+// Read what is available: false at the end of the file
+static bool readFd(Panel &panel) {
+  uint8_t buffer[64];
+  uint8_t data[LINK_MAX_FRAME];
+  ssize_t n = read(panel.fd, buffer, sizeof(buffer));
+
+  if (n < 0) {
+    return errno == EAGAIN || errno == EINTR;
+  }
+  for (ssize_t i = 0; i < n; i++) {
+    int size = receive(panel.rx, buffer[i], data);
+
+    if (size > 0) {
+      panelReceive(panel, data, size);
+    }
+  }
+  return n > 0;
+}
+
+static int openDevice(const char *name) {
+  int fd = open(name, O_RDWR | O_NOCTTY | O_NONBLOCK);
+
+  if (fd < 0 || !configure(fd)) {
+    perror(name);
+    return -1;
+  }
+  return fd;
+}
+
+int main(int argc, char *argv[]) {
+  Panel panel;
+  bool input = true;
+  const char *device = NULL;
+  char line[64];
+  int a;
+
+  memset(&panel, 0, sizeof(panel));
+  panel.address = PANEL_ADDRESS;
+  panel.board = LINK_ADDRESS;
+
+  for (a = 1; a < argc; a++) {
+    if (strcmp(argv[a], "-a") == 0 && a + 1 < argc) {
+      panel.address = strtoul(argv[++a], NULL, 0);
+    } else if (strcmp(argv[a], "-b") == 0 && a + 1 < argc) {
+      panel.board = strtoul(argv[++a], NULL, 0);
+    } else if (argv[a][0] != '-' && device == NULL) {
+      device = argv[a];
+    } else {
+      break;
+    }
+  }
+  if (a < argc || device == NULL || panel.address == 0 || panel.address == LINK_BROADCAST) {
+    fprintf(stderr, "Usage: %s [-a address] [-b board] device\n", argv[0]);
+    return 1;
+  }
+
+  panel.fd = openDevice(device);
+  if (panel.fd < 0) {
+    return 1;
+  }
+
+  srand(time(NULL));
+  // A restarted panel must not repeat the last sequence number seen by the board
+  panel.seq = rand();
+  setvbuf(stdout, NULL, _IOLBF, 0);
+  // Nothing read ahead of poll
+  setvbuf(stdin, NULL, _IONBF, 0);
+
+  // Until the end of the input, and of the last button
+  while (input || panel.waiting || now() < panel.pauseUntil) {
+    struct pollfd fds[2];
+    int count = 0;
+
+    if (input && !panel.waiting && now() >= panel.pauseUntil) {
+      fds[count].fd = STDIN_FILENO;
+      fds[count++].events = POLLIN;
+    }
+    fds[count].fd = panel.fd;
+    fds[count++].events = POLLIN;
+    if (poll(fds, count, POLL_INT) < 0 && errno != EINTR) {
+      perror("poll");
+      return 1;
+    }
+
+    for (int i = 0; i < count; i++) {
+      if (!(fds[i].revents & (POLLIN | POLLHUP))) {
+        continue;
+      }
+      if (fds[i].fd == STDIN_FILENO) {
+        if (fgets(line, sizeof(line), stdin) != NULL) {
+          panelLine(panel, line);
+        } else {
+          input = false;
+        }
+      } else {
+        readFd(panel);
+      }
+    }
+
+    panelCheck(panel);
+  }
+  return 0;
+}
@@ -0,0 +1,63 @@
+#!/bin/sh
+#
+#  This file is part of ScoreBoard project.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#    http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+
+# Flash and RAM of every main.cpp section ("module") of a firmware image, as
+# CSV lines (size,module,flash|ram,bytes) after the simavr_bench ones. The
+# symbols are assigned by name; initialized data counts in both.
+#
+# Usage: module_size.sh ScoreBoard.elf [avr-nm]
+
+ELF=$1
+NM=${2:-avr-nm}
+
+$NM --print-size --size-sort --demangle --radix=d "$ELF" | awk '
+function module(name) {
+  if (name ~ /^(hal|__vector_)/) return "hal"
+  if (name ~ /^(DisplayChain|display|disManager|mirrorChain|panelChain|font|layout|spiFrame)/) return "display"
+  if (name ~ /^brightness/) return "brightness"
+  if (name ~ /^(benchmark|bootFrameTime|digit$)/) return "benchmark"
+  if (name ~ /^(ladder|homeLadder|awayLadder|timerLadder|handle|bAVal|adc|onAdc|configureADC|median)/) return "input"
+  if (name ~ /^(log|printLog)/) return "eventlog"
+  if (name ~ /^(act|buttonAction)/) return "actions"
+  if (name ~ /^(countdown|onTimerTick|clockDigits|setTimer|resetTimer)/) return "clock"
+  if (name ~ /(EEPROM|EE$|EE\(|onEepromReady|indexEE|pendingEE)/) return "eeprom"
+  if (name ~ /^(bcd|toBcd|fromBcd)/) return "bcd"
+  if (name ~ /^(profile|printProfile)/) return "profiler"
+  if (name ~ /^remote/) return "remote"
+  if (name ~ /^(telemetry|cobsEncode)/) return "telemetry"
+  if (name ~ /^(buzzer|onPowerFail|powerFail)/) return "power"
+  if (name ~ /^(show|message)/) return "messages"
+  if (name ~ /^(sport|setSport)/) return "sport"
+  if (name ~ /^(setup|loop|serialPending|events|updateDisplay|saveEEprom|bScore|vScore|vSets|time$)/) return "main"
+  return "core"
+}
+NF >= 4 {
+  name = $4
+  for (i = 5; i <= NF; i++) name = name " " $i
+  size = $2 + 0
+  m = module(name)
+  if ($3 ~ /^[tTwWrRvV]$/) flash[m] += size
+  if ($3 ~ /^[dD]$/) { flash[m] += size; ram[m] += size }
+  if ($3 ~ /^[bB]$/) ram[m] += size
+  seen[m] = 1
+}
+END {
+  for (m in seen) {
+    printf "size,%s,flash,%d\n", m, flash[m]
+    printf "size,%s,ram,%d\n", m, ram[m]
+  }
+}' | sort
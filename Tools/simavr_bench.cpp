@@ -0,0 +1,314 @@
+/*
+ *  This file is part of ScoreBoard project.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * ScoreBoard cycle benchmark (host tool).
+ *
+ * Runs the firmware of a SIMULATOR build under simavr, instruction by
+ * instruction, with the analog button inputs driven by a script, and prints
+ * as CSV (kind,name,metric,value):
+ *   - the cycles of every loop phase, between the GPIOR0 markers written by the
+ *     PROFILE_* macros of main.cpp (interrupts included)
+ *   - the cycles and the latency (pending to vector entry) of every interrupt
+ *   - the peak stack depth
+ * The module sizes are added by module_size.sh (make bench).
+ *
+ * Script: one line per input change, "ms input value", input home, away or
+ * timer and value the ADC count (0-1023); the inputs start at 0 (released,
+ * pull down). "ms end" stops the simulation, "#" starts a comment.
+ *
+ * Build: g++ -O2 -o simavr_bench simavr_bench.cpp -lsimavr -lelf
+ * Usage: simavr_bench ScoreBoard.elf bench_script.txt > ScoreBoard.bench.csv
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <simavr/sim_avr.h>
+#include <simavr/sim_elf.h>
+#include <simavr/sim_irq.h>
+#include <simavr/sim_io.h>
+#include <simavr/sim_interrupts.h>
+#include <simavr/avr_adc.h>
+#include <simavr/avr_uart.h>
+
+#define MCU                     "atmega328p"
+#define FREQUENCY               16000000
+#define VCC_MV                  5000
+#define RAMEND                  0x08FF
+
+// GPIOR0 in the data space, and the markers of main.cpp
+#define GPIOR0_ADDRESS          0x3E
+#define SIM_MARK_START          0x80
+#define SIM_MARK_LOOP           0x81
+
+// Loop phases, as ProfilePhase in main.cpp
+static const char * const phaseName[] = { "snapshot", "buzzer", "display", "eeprom",
+                                          "input", "loop", "tick", "sleep" };
+#define PHASES                  8
+#define PHASE_LOOP              5
+
+// Interrupt vectors of the ATmega328P used by the firmware and the Arduino core
+struct Vector {
+  uint8_t number;
+  const char *name;
+};
+
+static const Vector vectors[] = {
+  { 9, "TIMER2_OVF" }, { 11, "TIMER1_COMPA" }, { 16, "TIMER0_OVF" }, { 17, "SPI_STC" },
+  { 18, "USART_RX" }, { 19, "USART_UDRE" }, { 21, "ADC" }, { 22, "EE_READY" },
+  { 23, "ANALOG_COMP" } };
+#define VECTORS                 (sizeof(vectors) / sizeof(vectors[0]))
+
+// Analog input channels of the button ladders
+struct Input {
+  const char *name;
+  int channel;
+};
+
+static const Input inputs[] = { { "home", 1 }, { "away", 3 }, { "timer", 5 } };
+#define INPUTS                  (sizeof(inputs) / sizeof(inputs[0]))
+
+#define MAX_STEPS               256
+
+struct Step {
+  unsigned long ms;
+  int channel;                  // -1: end of the simulation
+  unsigned value;
+};
+
+struct Stat {
+  unsigned long count;
+  uint64_t min;
+  uint64_t max;
+  uint64_t total;
+};
+
+struct VectorStat {
+  Stat cycles;
+  Stat latency;
+  uint64_t pendingCycle;
+  uint64_t runningCycle;
+  bool pending;
+};
+
+static avr_t *avr;
+static Stat phases[PHASES];
+static VectorStat vectorStats[VECTORS];
+static uint64_t phaseStart;
+static uint64_t loopStart;
+static bool phaseStarted = false;
+static bool loopStarted = false;
+
+static void add(Stat &stat, uint64_t value) {
+  if (stat.count == 0 || value < stat.min) {
+    stat.min = value;
+  }
+  if (value > stat.max) {
+    stat.max = value;
+  }
+  stat.total += value;
+  stat.count++;
+}
+
+static void print(const char *kind, const char *name, const Stat &stat) {
+  printf("%s,%s,count,%lu\n", kind, name, stat.count);
+  if (stat.count != 0) {
+    printf("%s,%s,cycles_min,%llu\n", kind, name, (unsigned long long) stat.min);
+    printf("%s,%s,cycles_max,%llu\n", kind, name, (unsigned long long) stat.max);
+    printf("%s,%s,cycles_avg,%llu\n", kind, name, (unsigned long long) (stat.total / stat.count));
+  }
+}
+
+// GPIOR0 written by the firmware
+static void onMark(avr_t *avr, avr_io_addr_t addr, uint8_t value, void *param) {
+  if (value == SIM_MARK_START) {
+    phaseStart = avr->cycle;
+    phaseStarted = true;
+  } else if (value == SIM_MARK_LOOP) {
+    loopStart = avr->cycle;
+    loopStarted = true;
+  } else if (value == PHASE_LOOP) {
+    if (loopStarted) {
+      add(phases[PHASE_LOOP], avr->cycle - loopStart);
+    }
+    loopStarted = false;
+  } else if (value < PHASES && phaseStarted) {
+    add(phases[value], avr->cycle - phaseStart);
+    phaseStarted = false;
+  }
+}
+
+static void onPending(avr_irq_t *irq, uint32_t value, void *param) {
+  VectorStat &stat = *(VectorStat *) param;
+
+  if (value && !stat.pending) {
+    stat.pendingCycle = avr->cycle;
+    stat.pending = true;
+  }
+}
+
+// Vector entered (1) and left by reti (0)
+static void onRunning(avr_irq_t *irq, uint32_t value, void *param) {
+  VectorStat &stat = *(VectorStat *) param;
+
+  if (value) {
+    stat.runningCycle = avr->cycle;
+    if (stat.pending) {
+      add(stat.latency, avr->cycle - stat.pendingCycle);
+      stat.pending = false;
+    }
+  } else {
+    add(stat.cycles, avr->cycle - stat.runningCycle);
+  }
+}
+
+static int readScript(const char *file, Step *steps) {
+  FILE *f = fopen(file, "r");
+  char line[128];
+  int count = 0;
+
+  if (f == NULL) {
+    return -1;
+  }
+  while (fgets(line, sizeof(line), f) != NULL && count < MAX_STEPS) {
+    char name[16];
+    Step &step = steps[count];
+    int fields = sscanf(line, "%lu %15s %u", &step.ms, name, &step.value);
+
+    if (fields < 2 || line[0] == '#') {
+      continue;
+    }
+    step.channel = -2;
+    if (strcmp(name, "end") == 0) {
+      step.channel = -1;
+    } else if (fields == 3) {
+      for (unsigned i = 0; i < INPUTS; i++) {
+        if (strcmp(name, inputs[i].name) == 0) {
+          step.channel = inputs[i].channel;
+        }
+      }
+    }
+    if (step.channel == -2 || (count > 0 && step.ms < steps[count - 1].ms)) {
+      fprintf(stderr, "%s: bad line: %s", file, line);
+      fclose(f);
+      return -1;
+    }
+    count++;
+  }
+  fclose(f);
+  return count;
+}
+
+int main(int argc, char *argv[]) {
+  elf_firmware_t firmware;
+  Step steps[MAX_STEPS];
+  int stepCount;
+  int step = 0;
+  uint64_t end;
+  uint32_t uartFlags = 0;
+  uint16_t minStack = RAMEND;
+  uint64_t worstLatency = 0;
+  int state = cpu_Running;
+
+  if (argc != 3) {
+    fprintf(stderr, "Usage: %s firmware.elf script\n", argv[0]);
+    return 1;
+  }
+  stepCount = readScript(argv[2], steps);
+  if (stepCount <= 0 || steps[stepCount - 1].channel != -1) {
+    fprintf(stderr, "%s: missing script or end line\n", argv[2]);
+    return 1;
+  }
+  end = (uint64_t) steps[stepCount - 1].ms * (FREQUENCY / 1000);
+
+  memset(&firmware, 0, sizeof(firmware));
+  if (elf_read_firmware(argv[1], &firmware) != 0) {
+    fprintf(stderr, "%s: cannot read the firmware\n", argv[1]);
+    return 1;
+  }
+  strcpy(firmware.mmcu, MCU);
+  firmware.frequency = FREQUENCY;
+
+  avr = avr_make_mcu_by_name(MCU);
+  if (avr == NULL) {
+    fprintf(stderr, "simavr without %s\n", MCU);
+    return 1;
+  }
+  avr_init(avr);
+  avr_load_firmware(avr, &firmware);
+  avr->vcc = VCC_MV;
+  avr->avcc = VCC_MV;
+  avr->aref = VCC_MV;
+
+  // The serial output of the firmware stays out of the CSV
+  avr_ioctl(avr, AVR_IOCTL_UART_GET_FLAGS('0'), &uartFlags);
+  uartFlags &= ~AVR_UART_FLAG_STDIO;
+  avr_ioctl(avr, AVR_IOCTL_UART_SET_FLAGS('0'), &uartFlags);
+
+  avr_register_io_write(avr, GPIOR0_ADDRESS, onMark, NULL);
+  for (unsigned v = 0; v < VECTORS; v++) {
+    avr_irq_t *irq = avr_get_interrupt_irq(avr, vectors[v].number);
+
+    if (irq != NULL) {
+      avr_irq_register_notify(irq + AVR_INT_IRQ_PENDING, onPending, &vectorStats[v]);
+      avr_irq_register_notify(irq + AVR_INT_IRQ_RUNNING, onRunning, &vectorStats[v]);
+    }
+  }
+  for (unsigned i = 0; i < INPUTS; i++) {
+    avr_raise_irq(avr_io_getirq(avr, AVR_IOCTL_ADC_GETIRQ, ADC_IRQ_ADC0 + inputs[i].channel), 0);
+  }
+
+  // One instruction per run, the stack pointer checked after every one
+  while (avr->cycle < end && state != cpu_Done && state != cpu_Crashed) {
+    uint16_t sp;
+
+    while (steps[step].channel >= 0 && avr->cycle >= (uint64_t) steps[step].ms * (FREQUENCY / 1000)) {
+      avr_raise_irq(avr_io_getirq(avr, AVR_IOCTL_ADC_GETIRQ, ADC_IRQ_ADC0 + steps[step].channel),
+          steps[step].value * VCC_MV / 1024);
+      step++;
+    }
+    state = avr_run(avr);
+    sp = avr->data[R_SPL] | (avr->data[R_SPH] << 8);
+    if (sp < minStack && sp != 0) {
+      minStack = sp;
+    }
+  }
+
+  printf("kind,name,metric,value\n");
+  printf("run,simulation,cycles,%llu\n", (unsigned long long) avr->cycle);
+  printf("run,simulation,crashed,%d\n", state == cpu_Crashed);
+  printf("stack,peak,bytes,%u\n", RAMEND - minStack);
+  for (int p = 0; p < PHASES; p++) {
+    print("phase", phaseName[p], phases[p]);
+  }
+  for (unsigned v = 0; v < VECTORS; v++) {
+    const VectorStat &stat = vectorStats[v];
+
+    print("isr", vectors[v].name, stat.cycles);
+    if (stat.latency.count != 0) {
+      printf("isr,%s,latency_max,%llu\n", vectors[v].name, (unsigned long long) stat.latency.max);
+      printf("isr,%s,latency_avg,%llu\n", vectors[v].name,
+          (unsigned long long) (stat.latency.total / stat.latency.count));
+      if (stat.latency.max > worstLatency) {
+        worstLatency = stat.latency.max;
+      }
+    }
+  }
+  printf("isr,all,latency_max,%llu\n", (unsigned long long) worstLatency);
+  return state == cpu_Crashed ? 1 : 0;
+}
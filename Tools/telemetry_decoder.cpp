@@ -0,0 +1,212 @@
+/*
+ *  This file is part of ScoreBoard project.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * ScoreBoard telemetry decoder (host tool).
+ *
+ * Reads the telemetry stream of a TELEMETRY build from standard input (a
+ * captured file or the serial device) and prints the scoreboard state every
+ * time a frame changes it. The frame format and message types must match the
+ * "Telemetry stream" section of main.cpp.
+ *
+ * Build: g++ -O2 -o telemetry_decoder telemetry_decoder.cpp
+ * Usage: stty -F /dev/ttyACM0 115200 raw && telemetry_decoder < /dev/ttyACM0
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Telemetry message types
+#define TM_SCORE                1
+#define TM_CLOCK                2
+#define TM_PERIOD               3
+#define TM_VOLLEY_SCORE         4
+#define TM_VOLLEY_SETS          5
+#define TM_BUZZER               6
+#define TM_MODE                 7
+#define TM_SHOT_CLOCK           8
+
+#define MAX_FRAME               64
+
+// Sport modes (TM_MODE), as SPORT_* in main.cpp
+static const char * const sportName[] = { "BASKET", "VOLLEY", "HANDBALL", "FUTSAL", "TABLE TENNIS" };
+static const bool sportSets[] = { false, true, false, false, true };
+#define SPORT_MODES             5
+
+struct State {
+  uint16_t home;
+  uint16_t away;
+  uint16_t clock;
+  uint8_t running;
+  uint16_t shotClock;
+  uint8_t shotRunning;
+  uint8_t period;
+  uint16_t vHome;
+  uint16_t vAway;
+  uint8_t sets[3];
+  uint8_t buzzer;
+  uint8_t mode;
+};
+
+static uint16_t crcCcittUpdate(uint16_t crc, uint8_t data) {
+  data ^= crc & 0xFF;
+  data ^= data << 4;
+  return ((((uint16_t) data << 8) | (crc >> 8)) ^ (uint8_t) (data >> 4) ^ ((uint16_t) data << 3));
+}
+
+static uint16_t word(const uint8_t *data) {
+  return data[0] | (data[1] << 8);
+}
+
+// Decode a COBS frame (delimiter excluded): returns the decoded size, -1 if malformed
+static int cobsDecode(const uint8_t *encoded, int size, uint8_t *data) {
+  int in = 0;
+  int out = 0;
+
+  while (in < size) {
+    int code = encoded[in++];
+
+    if (code == 0 || in + code - 1 > size) {
+      return -1;
+    }
+    for (int i = 1; i < code; i++) {
+      data[out++] = encoded[in++];
+    }
+    if (code < 0xFF && in < size) {
+      data[out++] = 0;
+    }
+  }
+  return out;
+}
+
+// Apply a message to the state: false if unknown or with the wrong size
+static bool apply(State &state, const uint8_t *message, int size) {
+  const uint8_t *p = message + 1;
+
+  switch (message[0]) {
+    case TM_SCORE:
+      if (size != 5) return false;
+      state.home = word(p);
+      state.away = word(p + 2);
+      return true;
+    case TM_CLOCK:
+      if (size != 4) return false;
+      state.clock = word(p);
+      state.running = p[2];
+      return true;
+    case TM_SHOT_CLOCK:
+      if (size != 4) return false;
+      state.shotClock = word(p);
+      state.shotRunning = p[2];
+      return true;
+    case TM_PERIOD:
+      if (size != 2) return false;
+      state.period = p[0];
+      return true;
+    case TM_VOLLEY_SCORE:
+      if (size != 5) return false;
+      state.vHome = word(p);
+      state.vAway = word(p + 2);
+      return true;
+    case TM_VOLLEY_SETS:
+      if (size != 4) return false;
+      state.sets[0] = p[0];
+      state.sets[1] = p[1];
+      state.sets[2] = p[2];
+      return true;
+    case TM_BUZZER:
+      if (size != 2) return false;
+      state.buzzer = p[0];
+      return true;
+    case TM_MODE:
+      if (size != 2) return false;
+      state.mode = p[0];
+      return true;
+  }
+  return false;
+}
+
+static bool same(const State &a, const State &b) {
+  return a.home == b.home && a.away == b.away && a.clock == b.clock && a.running == b.running
+      && a.shotClock == b.shotClock && a.shotRunning == b.shotRunning
+      && a.period == b.period && a.vHome == b.vHome && a.vAway == b.vAway
+      && a.sets[0] == b.sets[0] && a.sets[1] == b.sets[1] && a.sets[2] == b.sets[2]
+      && a.buzzer == b.buzzer && a.mode == b.mode;
+}
+
+static void print(const State &state) {
+  const char *name = state.mode < SPORT_MODES ? sportName[state.mode] : "?";
+
+  if (state.mode < SPORT_MODES && sportSets[state.mode]) {
+    printf("%s %u-%u  set %u  sets %u-%u", name, state.vHome, state.vAway, state.sets[0],
+        state.sets[1], state.sets[2]);
+  } else {
+    printf("%s %u-%u  period %u  clock %02u:%02u %s  shot %u %s", name, state.home, state.away,
+        state.period, state.clock / 60, state.clock % 60, state.running ? "running" : "stopped",
+        state.shotClock, state.shotRunning ? "running" : "stopped");
+  }
+  printf("%s\n", state.buzzer ? "  HORN" : "");
+  fflush(stdout);
+}
+
+int main() {
+  State state = State();
+  uint8_t frame[MAX_FRAME];
+  uint8_t message[MAX_FRAME];
+  int size = 0;
+  int c;
+  unsigned long frames = 0;
+  unsigned long errors = 0;
+
+  while ((c = getchar()) != EOF) {
+    if (c != 0) {
+      // Oversized frames are discarded at the next delimiter
+      if (size < MAX_FRAME) {
+        frame[size] = c;
+      }
+      size++;
+      continue;
+    }
+
+    if (size > 0) {
+      int length = size <= MAX_FRAME ? cobsDecode(frame, size, message) : -1;
+      uint16_t crc = 0xFFFF;
+
+      if (length >= 3) {
+        for (int i = 0; i < length - 2; i++) {
+          crc = crcCcittUpdate(crc, message[i]);
+        }
+      }
+
+      if (length >= 3 && crc == word(message + length - 2)) {
+        State previous = state;
+
+        frames++;
+        if (apply(state, message, length - 2) && !same(previous, state)) {
+          print(state);
+        }
+      } else {
+        // Text on the serial interface, or a corrupted frame
+        errors++;
+      }
+    }
+    size = 0;
+  }
+
+  fprintf(stderr, "%lu frames, %lu discarded\n", frames, errors);
+  return 0;
+}